@@ -178,14 +178,19 @@ int main(int argc, char *argv[])
 		die("out of memory?");
 
 #ifndef SYNC_PLAYER
-	if (sync_tcp_connect(rocket, "localhost", SYNC_DEFAULT_PORT))
-		die("failed to connect to host");
+	if (sync_tcp_connect_async(rocket, "localhost", SYNC_DEFAULT_PORT))
+		die("failed to look up host");
 #endif
 
 	/* get tracks */
-	const sync_track *clear_r = sync_get_track(rocket, "clear.r");
-	const sync_track *clear_g = sync_get_track(rocket, "clear.g");
-	const sync_track *clear_b = sync_get_track(rocket, "clear.b");
+	const sync_track *clear_rgb[] = {
+		sync_get_track(rocket, "clear.r"),
+		sync_get_track(rocket, "clear.g"),
+		sync_get_track(rocket, "clear.b")
+	};
+	const sync_group *clear = sync_get_group(rocket, clear_rgb, 3);
+	if (!clear)
+		die("out of memory?");
 	const sync_track *cam_rot = sync_get_track(rocket, "camera:rot.y");
 	const sync_track *cam_dist = sync_get_track(rocket, "camera:dist");
 
@@ -197,15 +202,15 @@ int main(int argc, char *argv[])
 	while (!done) {
 		double row = bass_get_row(stream);
 #ifndef SYNC_PLAYER
-		if (sync_update(rocket, (int)floor(row), &bass_cb, (void *)&stream))
-			sync_tcp_connect(rocket, "localhost", SYNC_DEFAULT_PORT);
+		/* connects, and reconnects, without holding up the frame */
+		sync_update(rocket, (int)floor(row), &bass_cb, (void *)&stream);
 #endif
 
 		/* draw */
 
-		glClearColor(float(sync_get_val(clear_r, row)),
-		             float(sync_get_val(clear_g, row)),
-		             float(sync_get_val(clear_b, row)), 1.0f);
+		float rgb[3];
+		sync_get_group_valsf(clear, row, rgb);
+		glClearColor(rgb[0], rgb[1], rgb[2], 1.0f);
 		glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 
 		float rot = float(sync_get_val(cam_rot, row));
@@ -240,6 +245,7 @@ int main(int argc, char *argv[])
 	}
 
 #ifndef SYNC_PLAYER
+	/* sync_save_bundle() packs them for sync_load_bundle() on release */
 	sync_save_tracks(rocket);
 #endif
 	sync_destroy_device(rocket);
@@ -32,4 +32,28 @@
  typedef unsigned int uint32_t;
 #endif
 
+/*
+ * Atomics for the fields shared with reader threads, see sync_publish().
+ * Those fields are volatile, which MSVC gives acquire and release
+ * semantics on x86. Targets without either are assumed single-threaded.
+ */
+#if defined(__GNUC__) && (__GNUC__ > 4 || (__GNUC__ == 4 && __GNUC_MINOR__ >= 7))
+ #define atomic_load_acquire(p) __atomic_load_n(p, __ATOMIC_ACQUIRE)
+ #define atomic_store_release(p, v) __atomic_store_n(p, v, __ATOMIC_RELEASE)
+ #define atomic_load_relaxed(p) __atomic_load_n(p, __ATOMIC_RELAXED)
+ #define atomic_store_relaxed(p, v) __atomic_store_n(p, v, __ATOMIC_RELAXED)
+ #define atomic_fence() __atomic_thread_fence(__ATOMIC_SEQ_CST)
+#else
+ #define atomic_load_acquire(p) (*(p))
+ #define atomic_store_release(p, v) (*(p) = (v))
+ #define atomic_load_relaxed(p) (*(p))
+ #define atomic_store_relaxed(p, v) (*(p) = (v))
+ #if defined(_MSC_VER) && (defined(_M_IX86) || defined(_M_X64))
+  #include <emmintrin.h>
+  #define atomic_fence() _mm_mfence()
+ #else
+  #define atomic_fence() ((void)0)
+ #endif
+#endif
+
 #endif /* SYNC_BASE_H */
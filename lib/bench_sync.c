@@ -0,0 +1,635 @@
+/* Micro-benchmarks for the sync library.
+ *
+ * Build and run with `make bench`, or run lib/bench_sync or
+ * lib/bench_sync-player with the names of the benchmarks to run as
+ * arguments.
+ */
+
+#include "sync.h"
+#include "track.h"
+#include "bundle.h"
+#include "sync_inline.h"
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+static double now(void)
+{
+	return (double)clock() / CLOCKS_PER_SEC;
+}
+
+static void report(const char *what, double secs, double ops)
+{
+	printf("  %-32s %8.3f s %10.2f ns/op\n", what, secs, secs * 1e9 / ops);
+}
+
+#ifndef SYNC_PLAYER
+
+/* a device with num_tracks tracks of num_keys random keys each */
+static struct sync_device *make_device(const struct sync_track **tracks,
+    int num_tracks, int num_keys, int max_row)
+{
+	struct sync_device *d = sync_create_device("bench");
+	int i, j;
+	char name[32];
+
+	for (i = 0; i < num_tracks; ++i) {
+		struct sync_track *t;
+		snprintf(name, sizeof(name), "bench:track%d", i);
+		t = (struct sync_track *)sync_get_track(d, name);
+		for (j = 0; j < num_keys; ++j) {
+			struct track_key k;
+			k.row = rand() % max_row;
+			k.value = (float)rand() / RAND_MAX;
+			k.type = (enum key_type)(rand() % KEY_TYPE_COUNT);
+			sync_set_key(t, &k);
+		}
+		/* as sync_update() does once the edits are applied */
+		sync_classify_track(t);
+		tracks[i] = t;
+	}
+	return d;
+}
+
+static void bench_batch(void)
+{
+	enum { NUM_TRACKS = 3000, NUM_FRAMES = 2000 };
+	static const struct sync_track *tracks[NUM_TRACKS];
+	static float out[NUM_TRACKS];
+	static double range[NUM_FRAMES];
+	struct sync_device *d = make_device(tracks, NUM_TRACKS, 64, 4096);
+	double start, sum[3] = { 0.0, 0.0, 0.0 };
+	int i, j;
+
+	start = now();
+	for (i = 0; i < NUM_FRAMES; ++i) {
+		double row = i * 0.37;
+		for (j = 0; j < NUM_TRACKS; ++j)
+			out[j] = (float)sync_get_val(tracks[j], row);
+		sum[0] += out[i % NUM_TRACKS];
+	}
+	report("sync_get_val per track", now() - start,
+	    (double)NUM_FRAMES * NUM_TRACKS);
+
+	start = now();
+	for (i = 0; i < NUM_FRAMES; ++i) {
+		double row = i * 0.37;
+		sync_get_valsf(tracks, NUM_TRACKS, row, out);
+		sum[1] += out[i % NUM_TRACKS];
+	}
+	report("sync_get_valsf", now() - start,
+	    (double)NUM_FRAMES * NUM_TRACKS);
+
+	/* the same batch through the SIMD kernel */
+	sync_set_simd(1);
+	start = now();
+	for (i = 0; i < NUM_FRAMES; ++i) {
+		double row = i * 0.37;
+		sync_get_valsf(tracks, NUM_TRACKS, row, out);
+		sum[2] += out[i % NUM_TRACKS];
+	}
+	report("sync_get_valsf, SIMD", now() - start,
+	    (double)NUM_FRAMES * NUM_TRACKS);
+	sync_set_simd(0);
+
+	if (sum[0] != sum[1] || sum[1] != sum[2])
+		printf("  (results differ: %g %g %g)\n",
+		    sum[0], sum[1], sum[2]);
+
+	/* every frame of one track after the other, as when plotting */
+	sum[0] = sum[1] = 0.0;
+	start = now();
+	for (j = 0; j < NUM_TRACKS; ++j)
+		for (i = 0; i < NUM_FRAMES; ++i)
+			sum[0] += sync_get_val(tracks[j], i * 0.37);
+	report("sync_get_val per row", now() - start,
+	    (double)NUM_FRAMES * NUM_TRACKS);
+
+	start = now();
+	for (j = 0; j < NUM_TRACKS; ++j) {
+		sync_get_vals_range(tracks[j], 0.0, 0.37, NUM_FRAMES, range);
+		for (i = 0; i < NUM_FRAMES; ++i)
+			sum[1] += range[i];
+	}
+	report("sync_get_vals_range", now() - start,
+	    (double)NUM_FRAMES * NUM_TRACKS);
+
+	if (sum[0] != sum[1])
+		printf("  (results differ: %g %g)\n", sum[0], sum[1]);
+	sync_destroy_device(d);
+}
+
+/* the lookup on its own, then with the segment fetch and evaluation */
+static double seek_track(const struct sync_track *t, const int *rows,
+    int num_seeks, const char *how)
+{
+	double start, sum = 0.0;
+	char what[64];
+	int i;
+
+	start = now();
+	for (i = 0; i < num_seeks; ++i)
+		sum += key_idx_floor(t, rows[i]);
+	snprintf(what, sizeof(what), "%d keys, %s", t->num_keys, how);
+	report(what, now() - start, num_seeks);
+
+	start = now();
+	for (i = 0; i < num_seeks; ++i)
+		sum += sync_get_val(t, rows[i]);
+	snprintf(what, sizeof(what), "%d keys, %s + eval", t->num_keys, how);
+	report(what, now() - start, num_seeks);
+	return sum;
+}
+
+static void bench_seek_track(int num_keys)
+{
+	enum { NUM_SEEKS = 2000000 };
+	const struct sync_track *track;
+	struct sync_track *t;
+	struct sync_device *d = make_device(&track, 1, 0, 1);
+	double sum;
+	int i, *rows = malloc(sizeof(int) * NUM_SEEKS);
+
+	t = (struct sync_track *)track;
+	for (i = 0; i < num_keys; ++i) {
+		struct track_key k;
+		k.row = i * 4;
+		k.value = (float)i;
+		k.type = KEY_LINEAR;
+		sync_set_key(t, &k);
+	}
+	sync_classify_track(t);
+	for (i = 0; i < NUM_SEEKS; ++i)
+		rows[i] = rand() % (num_keys * 4);
+
+	free(t->index);
+	t->index = NULL;
+	sum = seek_track(t, rows, NUM_SEEKS, "binary search");
+	sync_build_index(t);
+	sum -= seek_track(t, rows, NUM_SEEKS, "index");
+
+	if (sum != 0.0)
+		printf("  (results differ: %g)\n", sum);
+	free(rows);
+	sync_destroy_device(d);
+}
+
+static void bench_seek(void)
+{
+	bench_seek_track(10000);
+	bench_seek_track(100000);
+	bench_seek_track(1000000);
+}
+
+/* a full track transfer from the editor, as received by sync_update() */
+static void bench_stream(void)
+{
+	enum { NUM_KEYS = 200000, RUN = 256 };
+	const struct sync_track *tracks[2];
+	struct sync_device *d = make_device(tracks, 2, 0, 1);
+	struct track_key *keys = malloc(sizeof(*keys) * NUM_KEYS);
+	double start;
+	int i;
+
+	for (i = 0; i < NUM_KEYS; ++i) {
+		keys[i].row = i * 2;
+		keys[i].value = (float)i;
+		keys[i].type = KEY_LINEAR;
+	}
+
+	start = now();
+	for (i = 0; i < NUM_KEYS; ++i)
+		sync_set_key((struct sync_track *)tracks[0], keys + i);
+	report("sync_set_key", now() - start, NUM_KEYS);
+
+	start = now();
+	for (i = 0; i < NUM_KEYS; i += RUN)
+		sync_set_keys((struct sync_track *)tracks[1], keys + i,
+		    NUM_KEYS - i < RUN ? NUM_KEYS - i : RUN);
+	report("sync_set_keys", now() - start, NUM_KEYS);
+
+	free(keys);
+	sync_destroy_device(d);
+}
+
+/*
+ * Tracks like the ones in examples/example_bass.rocket: a key every few
+ * rows, most of them constant, STEP-only or LINEAR, a few smooth.
+ */
+static struct sync_track *make_demo_track(struct sync_device *d, int i,
+    int kind)
+{
+	struct sync_track *t;
+	char name[32];
+	int j, row = 0;
+
+	snprintf(name, sizeof(name), "bench:demo%d", i);
+	t = (struct sync_track *)sync_get_track(d, name);
+	for (j = 0; j < (kind ? 24 : 1); ++j) {
+		struct track_key k;
+		k.row = row;
+		k.value = (float)(rand() % 16) * 0.25f + 0.5f;
+		switch (kind) {
+		case 1:
+			k.type = KEY_STEP;
+			break;
+		case 2:
+			k.type = j % 2 ? KEY_STEP : KEY_LINEAR;
+			break;
+		default:
+			k.type = (enum key_type)(rand() % KEY_TYPE_COUNT);
+		}
+		sync_set_key(t, &k);
+		row += 4 + rand() % 12;
+	}
+	sync_classify_track(t);
+	return t;
+}
+
+static void bench_kinds(void)
+{
+	enum { NUM_TRACKS = 400, NUM_FRAMES = 20000 };
+	static const char *what[] = { "constant", "step", "linear", "mixed",
+	    "demo mix" };
+	static const struct sync_track *tracks[NUM_TRACKS];
+	struct sync_device *d = sync_create_device("bench");
+	double start, sum = 0.0;
+	int i, j, kind;
+
+	for (kind = 0; kind < 5; ++kind) {
+		for (i = 0; i < NUM_TRACKS; ++i) {
+			/* 40% constant, 25% step, 25% linear, 10% mixed */
+			int k = kind < 4 ? kind : (i % 20 < 8 ? 0 :
+			    i % 20 < 13 ? 1 : i % 20 < 18 ? 2 : 3);
+			tracks[i] = make_demo_track(d, kind * NUM_TRACKS + i, k);
+		}
+
+		start = now();
+		for (i = 0; i < NUM_FRAMES; ++i) {
+			double row = i * 0.0125;
+			for (j = 0; j < NUM_TRACKS; ++j)
+				sum += sync_get_val(tracks[j], row);
+		}
+		report(what[kind], now() - start,
+		    (double)NUM_FRAMES * NUM_TRACKS);
+	}
+
+	/* the demo mix again, through sync_inline.h */
+	start = now();
+	for (i = 0; i < NUM_FRAMES; ++i) {
+		double row = i * 0.0125;
+		for (j = 0; j < NUM_TRACKS; ++j)
+			sum += sync_get_val_inline(tracks[j], row);
+	}
+	report("demo mix, inline", now() - start,
+	    (double)NUM_FRAMES * NUM_TRACKS);
+
+	if (sum == 0.0)
+		printf("  (no work done)\n");
+	sync_destroy_device(d);
+}
+
+/* every track looked up by three passes a frame, with and without a cache */
+static void bench_frame(void)
+{
+	enum { NUM_TRACKS = 400, NUM_FRAMES = 5000, NUM_PASSES = 3 };
+	static const char *what[][2] = {
+		{ "demo mix, uncached", "demo mix, sync_begin_frame" },
+		{ "mixed, uncached", "mixed, sync_begin_frame" }
+	};
+	static const struct sync_track *tracks[NUM_TRACKS];
+	double start, sum = 0.0;
+	int i, j, mix, pass;
+
+	for (mix = 0; mix < 2; ++mix) {
+		struct sync_device *d = sync_create_device("bench");
+		for (i = 0; i < NUM_TRACKS; ++i)
+			tracks[i] = make_demo_track(d, i, mix ? 3 :
+			    i % 20 < 8 ? 0 : i % 20 < 13 ? 1 : i % 20 < 18 ? 2 : 3);
+
+		start = now();
+		for (i = 0; i < NUM_FRAMES; ++i) {
+			double row = i * 0.05;
+			for (pass = 0; pass < NUM_PASSES; ++pass)
+				for (j = 0; j < NUM_TRACKS; ++j)
+					sum += sync_get_val(tracks[j], row);
+		}
+		report(what[mix][0], now() - start,
+		    (double)NUM_FRAMES * NUM_TRACKS);
+
+		start = now();
+		for (i = 0; i < NUM_FRAMES; ++i) {
+			double row = i * 0.05;
+			sync_begin_frame(d, row);
+			for (pass = 0; pass < NUM_PASSES; ++pass)
+				for (j = 0; j < NUM_TRACKS; ++j)
+					sum += sync_get_val(tracks[j], row);
+		}
+		report(what[mix][1], now() - start,
+		    (double)NUM_FRAMES * NUM_TRACKS);
+
+		sync_destroy_device(d);
+	}
+
+	if (sum == 0.0)
+		printf("  (no work done)\n");
+}
+
+/* quaternions keyed on shared rows, per track, batched and as groups */
+static void bench_group(void)
+{
+	enum { NUM_GROUPS = 100, NUM_KEYS = 200, NUM_FRAMES = 20000 };
+	static const struct sync_track *tracks[NUM_GROUPS][4];
+	static const struct sync_group *groups[NUM_GROUPS];
+	struct sync_device *d = sync_create_device("bench");
+	double start, sum = 0.0, out[4];
+	int i, j, c;
+
+	for (i = 0; i < NUM_GROUPS; ++i) {
+		for (c = 0; c < 4; ++c) {
+			char name[32];
+			snprintf(name, sizeof(name), "bench:quat%d.%c", i, "xyzw"[c]);
+			tracks[i][c] = sync_get_track(d, name);
+		}
+		for (j = 0; j < NUM_KEYS; ++j) {
+			struct track_key k;
+			k.row = j * 8;
+			k.type = (enum key_type)(rand() % KEY_TYPE_COUNT);
+			for (c = 0; c < 4; ++c) {
+				k.value = (float)rand() / RAND_MAX;
+				sync_set_key((struct sync_track *)tracks[i][c], &k);
+			}
+		}
+		for (c = 0; c < 4; ++c)
+			sync_classify_track((struct sync_track *)tracks[i][c]);
+		groups[i] = sync_get_group(d, tracks[i], 4);
+	}
+
+	start = now();
+	for (i = 0; i < NUM_FRAMES; ++i) {
+		double row = i * 0.08;
+		for (j = 0; j < NUM_GROUPS; ++j)
+			for (c = 0; c < 4; ++c)
+				sum += sync_get_val(tracks[j][c], row);
+	}
+	report("sync_get_val", now() - start, (double)NUM_FRAMES * NUM_GROUPS);
+
+	start = now();
+	for (i = 0; i < NUM_FRAMES; ++i) {
+		double row = i * 0.08;
+		for (j = 0; j < NUM_GROUPS; ++j) {
+			sync_get_vals(tracks[j], 4, row, out);
+			sum += out[0];
+		}
+	}
+	report("sync_get_vals", now() - start, (double)NUM_FRAMES * NUM_GROUPS);
+
+	start = now();
+	for (i = 0; i < NUM_FRAMES; ++i) {
+		double row = i * 0.08;
+		for (j = 0; j < NUM_GROUPS; ++j) {
+			sync_get_group_vals(groups[j], row, out);
+			sum += out[0];
+		}
+	}
+	report("sync_get_group_vals", now() - start,
+	    (double)NUM_FRAMES * NUM_GROUPS);
+
+	if (sum == 0.0)
+		printf("  (no work done)\n");
+	sync_destroy_device(d);
+}
+
+/* resolving track names at startup and then every frame */
+static void bench_lookup(void)
+{
+	enum { NUM_TRACKS = 5000, NUM_FRAMES = 100 };
+	struct sync_device *d = sync_create_device("bench");
+	static char names[NUM_TRACKS][32];
+	double start;
+	int i, j;
+
+	for (i = 0; i < NUM_TRACKS; ++i)
+		snprintf(names[i], sizeof(names[i]), "scene%d:object%d.param%d",
+		    i % 7, i / 7 % 50, i);
+
+	start = now();
+	for (i = 0; i < NUM_TRACKS; ++i)
+		sync_get_track(d, names[i]);
+	report("create (incl. track file open)", now() - start, NUM_TRACKS);
+
+	start = now();
+	for (i = 0; i < NUM_FRAMES; ++i)
+		for (j = 0; j < NUM_TRACKS; ++j)
+			sync_get_track(d, names[j]);
+	report("lookup", now() - start, (double)NUM_FRAMES * NUM_TRACKS);
+
+	sync_destroy_device(d);
+}
+
+#else
+
+static long io_reads;
+
+static void *slow_open(const char *path, const char *mode)
+{
+	return fopen(path, mode);
+}
+
+/* every call pays a fixed cost, like an archive or packer backend */
+static size_t slow_read(void *ptr, size_t size, size_t nitems, void *fp)
+{
+	volatile int spin;
+	for (spin = 0; spin < 200; ++spin)
+		;
+	io_reads++;
+	return fread(ptr, size, nitems, (FILE *)fp);
+}
+
+static int slow_close(void *fp)
+{
+	return fclose((FILE *)fp);
+}
+
+static void load_tracks(const char *what, int num_tracks, int num_keys,
+    struct sync_io_cb *cb)
+{
+	struct sync_device *d = sync_create_device("bench_load");
+	char name[32];
+	double start;
+	int i;
+
+	if (cb)
+		sync_set_io_cb(d, cb);
+
+	io_reads = 0;
+	start = now();
+	for (i = 0; i < num_tracks; ++i) {
+		snprintf(name, sizeof(name), "track%d", i);
+		if (sync_get_track(d, name)->num_keys != num_keys)
+			printf("  (track %d failed to load)\n", i);
+	}
+	report(what, now() - start, (double)num_tracks * num_keys);
+	if (cb)
+		printf("  %-32s %8.2f\n", "reads per track",
+		    (double)io_reads / num_tracks);
+
+	sync_destroy_device(d);
+}
+
+/* loading a demo's .track files at startup, in the save_track() format */
+static void bench_load(void)
+{
+	enum { NUM_TRACKS = 500, NUM_KEYS = 2000 };
+	struct sync_io_cb slow;
+	char path[64];
+	int i, j;
+
+	for (i = 0; i < NUM_TRACKS; ++i) {
+		int num_keys = NUM_KEYS;
+		FILE *fp;
+
+		snprintf(path, sizeof(path), "bench_load_track%d.track", i);
+		fp = fopen(path, "wb");
+		if (!fp) {
+			perror(path);
+			return;
+		}
+		fwrite(&num_keys, sizeof(int), 1, fp);
+		for (j = 0; j < NUM_KEYS; ++j) {
+			int row = j * 3;
+			float value = (float)rand() / RAND_MAX;
+			char type = (char)(rand() % KEY_TYPE_COUNT);
+			fwrite(&row, sizeof(int), 1, fp);
+			fwrite(&value, sizeof(float), 1, fp);
+			fwrite(&type, sizeof(char), 1, fp);
+		}
+		fclose(fp);
+	}
+
+	slow.open = slow_open;
+	slow.read = slow_read;
+	slow.close = slow_close;
+	load_tracks("stdio", NUM_TRACKS, NUM_KEYS, NULL);
+	load_tracks("slow io_cb", NUM_TRACKS, NUM_KEYS, &slow);
+
+	for (i = 0; i < NUM_TRACKS; ++i) {
+		snprintf(path, sizeof(path), "bench_load_track%d.track", i);
+		remove(path);
+	}
+}
+
+/* unpack a bundle of smooth, demo-like tracks already in memory */
+static void decode_bundle(const char *what, struct sync_track *const *tracks,
+    int num_tracks, float precision)
+{
+	enum { NUM_PASSES = 20 };
+	struct track_key *keys;
+	unsigned char *buf;
+	uint32_t n;
+	double start;
+	long size, num_keys = 0;
+	int i, j;
+	FILE *fp;
+
+	for (i = 0; i < num_tracks; ++i) {
+		tracks[i]->precision = precision;
+		num_keys += tracks[i]->num_keys;
+	}
+	if (bundle_write("bench_decode.bundle", tracks, num_tracks))
+		return;
+
+	fp = fopen("bench_decode.bundle", "rb");
+	fseek(fp, 0, SEEK_END);
+	size = ftell(fp);
+	rewind(fp);
+	buf = malloc(size);
+	keys = malloc(sizeof(struct track_key) * tracks[0]->num_keys);
+	if (fread(buf, 1, size, fp) != (size_t)size || bundle_open(buf, size, &n))
+		printf("  (%s: bad bundle)\n", what);
+	fclose(fp);
+	remove("bench_decode.bundle");
+
+	start = now();
+	for (j = 0; j < NUM_PASSES; ++j)
+		for (i = 0; i < num_tracks; ++i) {
+			struct bundle_entry e;
+			if (bundle_get_entry(buf, size, i, &e) ||
+			    bundle_decode_keys(&e, keys))
+				printf("  (%s: bad track %d)\n", what, i);
+		}
+	report(what, now() - start, (double)NUM_PASSES * num_keys);
+	printf("  %-32s %8.2f\n", "bytes per key", (double)size / num_keys);
+
+	free(keys);
+	free(buf);
+}
+
+static void bench_decode(void)
+{
+	enum { NUM_TRACKS = 500, NUM_KEYS = 2000 };
+	static struct sync_track tracks[NUM_TRACKS];
+	struct sync_track *ptrs[NUM_TRACKS];
+	static char names[NUM_TRACKS][32];
+	int i, j;
+
+	for (i = 0; i < NUM_TRACKS; ++i) {
+		struct sync_track *t = tracks + i;
+		snprintf(names[i], sizeof(names[i]), "track%d", i);
+		t->name = names[i];
+		t->keys = malloc(sizeof(struct track_key) * NUM_KEYS);
+		t->num_keys = NUM_KEYS;
+		for (j = 0; j < NUM_KEYS; ++j) {
+			t->keys[j].row = j * 4 + rand() % 4;
+			t->keys[j].value = (float)(sin(j * 0.05 + i) * 10.0);
+			t->keys[j].type = j / 16 % 2 ? KEY_SMOOTH : KEY_LINEAR;
+		}
+		ptrs[i] = t;
+	}
+
+	decode_bundle("raw", ptrs, NUM_TRACKS, -1.0f);
+	decode_bundle("packed, exact", ptrs, NUM_TRACKS, 0.0f);
+	decode_bundle("packed, step 1/1024", ptrs, NUM_TRACKS, 1.0f / 1024);
+
+	for (i = 0; i < NUM_TRACKS; ++i)
+		free(tracks[i].keys);
+}
+
+#endif /* defined(SYNC_PLAYER) */
+
+static const struct {
+	const char *name;
+	void (*func)(void);
+} benchmarks[] = {
+#ifndef SYNC_PLAYER
+	{ "batch", bench_batch },
+	{ "kinds", bench_kinds },
+	{ "group", bench_group },
+	{ "frame", bench_frame },
+	{ "lookup", bench_lookup },
+	{ "seek", bench_seek },
+	{ "stream", bench_stream },
+#else
+	{ "decode", bench_decode },
+	{ "load", bench_load },
+#endif
+};
+
+int main(int argc, char *argv[])
+{
+	int i, j;
+	for (i = 0; i < (int)(sizeof(benchmarks) / sizeof(benchmarks[0])); ++i) {
+		int run = argc < 2;
+		for (j = 1; j < argc; ++j)
+			run |= !strcmp(argv[j], benchmarks[i].name);
+		if (!run)
+			continue;
+
+		printf("%s:\n", benchmarks[i].name);
+		srand(1);
+		benchmarks[i].func();
+	}
+	return 0;
+}
@@ -0,0 +1,434 @@
+#include "bundle.h"
+#include <assert.h>
+#include <limits.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+static uint32_t get_u32(const unsigned char *p)
+{
+	return (uint32_t)p[0] | (uint32_t)p[1] << 8 |
+	    (uint32_t)p[2] << 16 | (uint32_t)p[3] << 24;
+}
+
+static void put_u32(unsigned char *p, uint32_t v)
+{
+	p[0] = (unsigned char)v;
+	p[1] = (unsigned char)(v >> 8);
+	p[2] = (unsigned char)(v >> 16);
+	p[3] = (unsigned char)(v >> 24);
+}
+
+static uint32_t zigzag(uint32_t v)
+{
+	return v << 1 ^ (0 - (v >> 31));
+}
+
+static uint32_t unzigzag(uint32_t v)
+{
+	return v >> 1 ^ (0 - (v & 1));
+}
+
+/* two's complement, without relying on implementation-defined casts */
+static int to_int(uint32_t v)
+{
+	return v < 0x80000000u ? (int)v : -(int)(0xffffffffu - v) - 1;
+}
+
+static size_t align(size_t offset)
+{
+	return (offset + BUNDLE_ALIGN - 1) & ~(size_t)(BUNDLE_ALIGN - 1);
+}
+
+int bundle_open(const void *buf, size_t len, uint32_t *num_tracks)
+{
+	const unsigned char *p = buf;
+
+	if (len < BUNDLE_HEADER_SIZE || memcmp(p, BUNDLE_MAGIC, 4) ||
+	    get_u32(p + 4) != BUNDLE_VERSION || get_u32(p + 12) != len)
+		return -1;
+
+	*num_tracks = get_u32(p + 8);
+	if (*num_tracks > (len - BUNDLE_HEADER_SIZE) / BUNDLE_ENTRY_SIZE)
+		return -1;
+	return 0;
+}
+
+int bundle_get_entry(const void *buf, size_t len, uint32_t i,
+    struct bundle_entry *e)
+{
+	const unsigned char *p = buf;
+	const unsigned char *entry = p + BUNDLE_HEADER_SIZE +
+	    BUNDLE_ENTRY_SIZE * i;
+	uint32_t name = get_u32(entry), data = get_u32(entry + 4);
+
+	e->size = get_u32(entry + 8);
+	e->num_keys = get_u32(entry + 12);
+	e->encoding = get_u32(entry + 16);
+
+	if (name >= len || !memchr(p + name, '\0', len - name) ||
+	    data > len || e->size > len - data || data % BUNDLE_ALIGN ||
+	    e->encoding >= BUNDLE_ENCODING_COUNT)
+		return -1;
+
+	if (e->encoding == BUNDLE_RAW &&
+	    (e->num_keys > INT_MAX / BUNDLE_RAW_KEY_SIZE ||
+	    e->size != e->num_keys * BUNDLE_RAW_KEY_SIZE))
+		return -1;
+
+	/* every packed key takes at least one byte */
+	if (e->encoding == BUNDLE_PACKED &&
+	    (e->size < 4 || e->num_keys > e->size ||
+	    e->num_keys > INT_MAX / sizeof(struct track_key)))
+		return -1;
+
+	e->name = (const char *)p + name;
+	e->data = p + data;
+	return 0;
+}
+
+/* keys must be sorted by row with valid types, as sync_get_val relies on */
+static int valid_keys(const struct track_key *keys, uint32_t num_keys)
+{
+	uint32_t i;
+	for (i = 0; i < num_keys; ++i)
+		if ((unsigned)keys[i].type >= KEY_TYPE_COUNT ||
+		    (i && keys[i - 1].row >= keys[i].row))
+			return 0;
+	return 1;
+}
+
+const struct track_key *bundle_keys_in_place(const struct bundle_entry *e)
+{
+	static const uint32_t one = 1;
+	const struct track_key *keys = (const struct track_key *)e->data;
+
+	if (e->encoding != BUNDLE_RAW ||
+	    *(const unsigned char *)&one != 1 ||
+	    sizeof(struct track_key) != BUNDLE_RAW_KEY_SIZE ||
+	    sizeof(enum key_type) != 4 ||
+	    (size_t)e->data % sizeof(int))
+		return NULL;
+
+	return valid_keys(keys, e->num_keys) ? keys : NULL;
+}
+
+struct reader {
+	const unsigned char *p, *end;
+};
+
+static int get_varint(struct reader *r, uint32_t *v)
+{
+	int shift;
+
+	/* small deltas and runs are the common case */
+	if (r->p < r->end && *r->p < 0x80) {
+		*v = *r->p++;
+		return 0;
+	}
+
+	*v = 0;
+	for (shift = 0; shift < 35 && r->p < r->end; shift += 7) {
+		unsigned char b = *r->p++;
+		if (shift == 28 && b > 0x0f)
+			return -1;
+		*v |= (uint32_t)(b & 0x7f) << shift;
+		if (!(b & 0x80))
+			return 0;
+	}
+	return -1;
+}
+
+static int decode_raw(const struct bundle_entry *e, struct track_key *keys)
+{
+	const unsigned char *p = e->data;
+	uint32_t i;
+
+	for (i = 0; i < e->num_keys; ++i, p += BUNDLE_RAW_KEY_SIZE) {
+		union {
+			float f;
+			uint32_t i;
+		} v;
+		keys[i].row = (int)get_u32(p);
+		v.i = get_u32(p + 4);
+		keys[i].value = v.f;
+		keys[i].type = (enum key_type)get_u32(p + 8);
+	}
+
+	return valid_keys(keys, e->num_keys) ? 0 : -1;
+}
+
+/* one sequential pass over each section, straight into keys */
+static int decode_packed(const struct bundle_entry *e, struct track_key *keys)
+{
+	struct reader r;
+	union {
+		float f;
+		uint32_t i;
+	} v;
+	uint32_t i, n, row, q;
+	double step;
+
+	r.p = e->data;
+	r.end = e->data + e->size;
+	v.i = get_u32(r.p);
+	step = v.f;
+	r.p += 4;
+
+	/* rows are kept offset by 2^31 here, which makes them unsigned */
+	for (i = 0; i < e->num_keys; ++i) {
+		if (get_varint(&r, &n))
+			return -1;
+		if (!i)
+			row = unzigzag(n) ^ 0x80000000u;
+		else if (!n || n > 0xffffffffu - row)
+			return -1;
+		else
+			row += n;
+		keys[i].row = to_int(row ^ 0x80000000u);
+	}
+
+	for (i = 0; i < e->num_keys; i += n) {
+		enum key_type type;
+		uint32_t j;
+		if (get_varint(&r, &n))
+			return -1;
+		type = (enum key_type)(n % KEY_TYPE_COUNT);
+		n = n / KEY_TYPE_COUNT + 1;
+		if (n > e->num_keys - i)
+			return -1;
+		for (j = i; j < i + n; ++j)
+			keys[j].type = type;
+	}
+
+	if (step == 0.0) {
+		if ((size_t)(r.end - r.p) != 4 * e->num_keys)
+			return -1;
+		for (i = 0; i < e->num_keys; ++i, r.p += 4) {
+			v.i = get_u32(r.p);
+			keys[i].value = v.f;
+		}
+	} else {
+		for (i = 0, q = 0; i < e->num_keys; ++i) {
+			if (get_varint(&r, &n))
+				return -1;
+			q += unzigzag(n);
+			keys[i].value = (float)(to_int(q) * step);
+		}
+	}
+
+	return r.p == r.end ? 0 : -1;
+}
+
+int bundle_decode_keys(const struct bundle_entry *e, struct track_key *keys)
+{
+	switch (e->encoding) {
+	case BUNDLE_RAW:
+		return decode_raw(e, keys);
+	case BUNDLE_PACKED:
+		return decode_packed(e, keys);
+	default:
+		assert(0);
+		return -1;
+	}
+}
+
+/* writes to p if set, or only counts */
+struct writer {
+	unsigned char *p;
+	size_t size;
+};
+
+static void put_byte(struct writer *w, unsigned char b)
+{
+	if (w->p)
+		w->p[w->size] = b;
+	w->size++;
+}
+
+static void put_varint(struct writer *w, uint32_t v)
+{
+	while (v >= 0x80) {
+		put_byte(w, (unsigned char)(v | 0x80));
+		v >>= 7;
+	}
+	put_byte(w, (unsigned char)v);
+}
+
+static void put_word(struct writer *w, uint32_t v)
+{
+	put_byte(w, (unsigned char)v);
+	put_byte(w, (unsigned char)(v >> 8));
+	put_byte(w, (unsigned char)(v >> 16));
+	put_byte(w, (unsigned char)(v >> 24));
+}
+
+static void encode_raw(struct writer *w, const struct sync_track *t)
+{
+	int i;
+	for (i = 0; i < t->num_keys; ++i) {
+		const struct track_key *k = t->keys + i;
+		union {
+			float f;
+			uint32_t i;
+		} v;
+		v.f = k->value;
+		put_word(w, (uint32_t)k->row);
+		put_word(w, v.i);
+		put_word(w, (uint32_t)k->type);
+	}
+}
+
+/* the quantization step for t, or 0 if its values must be kept exact */
+static double quant_step(const struct sync_track *t)
+{
+	double step = t->precision;
+	int i;
+
+	if (!(step > 0.0 && step < HUGE_VAL))
+		return 0.0;
+
+	/* keep the quantized deltas within 32 bits */
+	for (i = 0; i < t->num_keys; ++i)
+		if (!(fabs(t->keys[i].value / step) < 0x40000000))
+			return 0.0;
+	return step;
+}
+
+static void encode_packed(struct writer *w, const struct sync_track *t)
+{
+	union {
+		float f;
+		uint32_t i;
+	} v;
+	uint32_t prev;
+	double step = quant_step(t);
+	int i, j;
+
+	v.f = (float)step;
+	put_word(w, v.i);
+
+	for (i = 0, prev = 0; i < t->num_keys; ++i) {
+		uint32_t row = (uint32_t)t->keys[i].row;
+		put_varint(w, i ? row - prev : zigzag(row));
+		prev = row;
+	}
+
+	for (i = 0; i < t->num_keys; i = j) {
+		for (j = i + 1; j < t->num_keys &&
+		    t->keys[j].type == t->keys[i].type; ++j)
+			;
+		put_varint(w, (uint32_t)(j - i - 1) * KEY_TYPE_COUNT +
+		    t->keys[i].type);
+	}
+
+	for (i = 0, prev = 0; i < t->num_keys; ++i) {
+		if (step == 0.0) {
+			v.f = t->keys[i].value;
+			put_word(w, v.i);
+		} else {
+			uint32_t q = (uint32_t)(int)floor(
+			    t->keys[i].value / step + 0.5);
+			put_varint(w, zigzag(q - prev));
+			prev = q;
+		}
+	}
+}
+
+static size_t encode_keys(unsigned char *out, const struct sync_track *t)
+{
+	struct writer w;
+	w.p = out;
+	w.size = 0;
+	if (t->precision < 0.0f)
+		encode_raw(&w, t);
+	else
+		encode_packed(&w, t);
+	return w.size;
+}
+
+static int write_u32(FILE *fp, uint32_t v)
+{
+	unsigned char b[4];
+	put_u32(b, v);
+	return fwrite(b, 1, 4, fp) != 4;
+}
+
+static int write_padding(FILE *fp, size_t offset)
+{
+	static const unsigned char zero[BUNDLE_ALIGN];
+	size_t pad = align(offset) - offset;
+	return pad && fwrite(zero, 1, pad, fp) != pad;
+}
+
+int bundle_write(const char *path, struct sync_track *const *tracks,
+    size_t num_tracks)
+{
+	size_t i, name, data, size, max_size = 0;
+	unsigned char *buf;
+	int err = 0;
+	FILE *fp;
+
+	/* lay out names and key blocks, to know the offsets up front */
+	name = BUNDLE_HEADER_SIZE + BUNDLE_ENTRY_SIZE * num_tracks;
+	size = name;
+	for (i = 0; i < num_tracks; ++i)
+		size += strlen(tracks[i]->name) + 1;
+	for (i = 0; i < num_tracks; ++i) {
+		size_t key_size = encode_keys(NULL, tracks[i]);
+		max_size = key_size > max_size ? key_size : max_size;
+		size = align(size) + key_size;
+	}
+	if (size > UINT32_MAX)
+		return -1;
+
+	buf = malloc(max_size ? max_size : 1);
+	if (!buf)
+		return -1;
+
+	fp = fopen(path, "wb");
+	if (!fp) {
+		free(buf);
+		return -1;
+	}
+
+	err |= fwrite(BUNDLE_MAGIC, 1, 4, fp) != 4;
+	err |= write_u32(fp, BUNDLE_VERSION);
+	err |= write_u32(fp, (uint32_t)num_tracks);
+	err |= write_u32(fp, (uint32_t)size);
+
+	data = name;
+	for (i = 0; i < num_tracks; ++i)
+		data += strlen(tracks[i]->name) + 1;
+	for (i = 0; i < num_tracks; ++i) {
+		size_t key_size = encode_keys(NULL, tracks[i]);
+		data = align(data);
+		err |= write_u32(fp, (uint32_t)name);
+		err |= write_u32(fp, (uint32_t)data);
+		err |= write_u32(fp, (uint32_t)key_size);
+		err |= write_u32(fp, (uint32_t)tracks[i]->num_keys);
+		err |= write_u32(fp, tracks[i]->precision < 0.0f ?
+		    BUNDLE_RAW : BUNDLE_PACKED);
+		name += strlen(tracks[i]->name) + 1;
+		data += key_size;
+	}
+
+	for (i = 0; i < num_tracks; ++i) {
+		size_t len = strlen(tracks[i]->name) + 1;
+		err |= fwrite(tracks[i]->name, 1, len, fp) != len;
+	}
+
+	data = name;
+	for (i = 0; i < num_tracks; ++i) {
+		size_t key_size = encode_keys(buf, tracks[i]);
+		err |= write_padding(fp, data);
+		err |= fwrite(buf, 1, key_size, fp) != key_size;
+		data = align(data) + key_size;
+	}
+	assert(err || data == size);
+
+	free(buf);
+	err |= fclose(fp) != 0;
+	return err ? -1 : 0;
+}
@@ -0,0 +1,57 @@
+#ifndef SYNC_BUNDLE_H
+#define SYNC_BUNDLE_H
+
+#include "base.h"
+#include "track.h"
+
+/*
+ * A bundle holds all tracks of a device in a single file:
+ *
+ *   header     magic, version, number of tracks, file size
+ *   directory  per track: name offset, data offset, data size,
+ *              number of keys, encoding
+ *   names      NUL-terminated
+ *   data       BUNDLE_ALIGN-aligned key blocks
+ *
+ * Every field is a little-endian 32-bit integer. A raw key block stores
+ * row, value (IEEE-754 single) and type per key, which is the layout of
+ * struct track_key on little-endian hosts, so it can be used in place.
+ *
+ * A packed key block trades that for size, and is decoded on load:
+ *
+ *   step    32-bit float, the value quantization step or 0 for exact
+ *   rows    first row zigzag-encoded, then the distance to the previous
+ *   types   runs, as (length - 1) * KEY_TYPE_COUNT + type
+ *   values  with a step, zigzag deltas of round(value / step),
+ *           otherwise 32-bit floats
+ *
+ * Apart from step and exact values, all of these are LEB128 varints.
+ */
+#define BUNDLE_MAGIC "RKTB"
+#define BUNDLE_VERSION 1
+#define BUNDLE_ALIGN 16
+#define BUNDLE_HEADER_SIZE 16
+#define BUNDLE_ENTRY_SIZE 20
+#define BUNDLE_RAW_KEY_SIZE 12
+
+enum bundle_encoding {
+	BUNDLE_RAW,
+	BUNDLE_PACKED,
+	BUNDLE_ENCODING_COUNT
+};
+
+struct bundle_entry {
+	const char *name;
+	const unsigned char *data;
+	uint32_t size, num_keys, encoding;
+};
+
+int bundle_open(const void *buf, size_t len, uint32_t *num_tracks);
+int bundle_get_entry(const void *buf, size_t len, uint32_t i,
+    struct bundle_entry *e);
+const struct track_key *bundle_keys_in_place(const struct bundle_entry *e);
+int bundle_decode_keys(const struct bundle_entry *e, struct track_key *keys);
+int bundle_write(const char *path, struct sync_track *const *tracks,
+    size_t num_tracks);
+
+#endif /* SYNC_BUNDLE_H */
@@ -1,12 +1,15 @@
 #include "device.h"
 #include "track.h"
+#include "bundle.h"
 #include <assert.h>
 #include <ctype.h>
+#include <limits.h>
 #include <math.h>
 #include <stdio.h>
 #include <string.h>
 
 #include <sys/stat.h>
+#include <time.h>
 
 #ifdef WIN32
  #include <direct.h>
@@ -14,17 +17,84 @@
  #define mkdir(pathname, mode) _mkdir(pathname)
 #endif
 
-void sync_tcp_device_dtor(void); /* not worth adding a tcp.h for */
+#if defined(SYNC_PLAYER) && defined(USE_MMAP)
+ #include <sys/mman.h>
+ #include <fcntl.h>
+ #include <unistd.h>
+#endif
+
+/* not worth adding a tcp.h for */
+void sync_tcp_device_dtor(void);
+#ifndef SYNC_PLAYER
+int sync_tcp_reconnect(struct sync_device *);
+void sync_tcp_free_reconnect(struct tcp_reconnect *);
+#endif
 
+/* 32-bit FNV-1a */
+static uint32_t hash_name(const char *name)
+{
+	uint32_t hash = 2166136261u;
+	while (*name) {
+		hash ^= (unsigned char)*name++;
+		hash *= 16777619u;
+	}
+	return hash;
+}
+
+/*
+ * Tracks are found through an open-addressing hash table with linear
+ * probing, kept at most half full. Only names with a matching hash are
+ * compared.
+ */
 static int find_track(struct sync_device *d, const char *name)
 {
-	int i;
-	for (i = 0; i < (int)d->num_tracks; ++i)
-		if (!strcmp(name, d->tracks[i]->name))
-			return i;
+	uint32_t hash = hash_name(name);
+	size_t i, mask = d->hash_size - 1;
+
+	if (!d->hash_size)
+		return -1;
+
+	for (i = hash & mask; d->track_hash[i].track; i = (i + 1) & mask) {
+		int idx = d->track_hash[i].track - 1;
+		if (d->track_hash[i].hash == hash &&
+		    !strcmp(name, d->tracks[idx]->name))
+			return idx;
+	}
 	return -1; /* not found */
 }
 
+static void insert_track_slot(struct track_slot *slots, size_t size,
+    uint32_t hash, int track)
+{
+	size_t i, mask = size - 1;
+	for (i = hash & mask; slots[i].track; i = (i + 1) & mask)
+		;
+	slots[i].hash = hash;
+	slots[i].track = track + 1;
+}
+
+static int add_track_hash(struct sync_device *d, int track)
+{
+	if (2 * (d->num_tracks + 1) > d->hash_size) {
+		size_t i, size = d->hash_size ? 2 * d->hash_size : 64;
+		struct track_slot *slots = calloc(size, sizeof(*slots));
+		if (!slots)
+			return -1;
+		for (i = 0; i < d->hash_size; ++i)
+			if (d->track_hash[i].track)
+				insert_track_slot(slots, size,
+				    d->track_hash[i].hash,
+				    d->track_hash[i].track - 1);
+		free(d->track_hash);
+		d->track_hash = slots;
+		d->hash_size = size;
+	}
+
+	insert_track_slot(d->track_hash, d->hash_size,
+	    hash_name(d->tracks[track]->name), track);
+	return 0;
+}
+
 static int valid_path_char(int ch)
 {
 	switch (ch) {
@@ -75,6 +145,15 @@ static const char *sync_track_path(const char *base, const char *name)
 	return temp;
 }
 
+static const char *sync_bundle_path(const char *base)
+{
+	static char temp[FILENAME_MAX];
+	strncpy(temp, base, sizeof(temp) - 1);
+	temp[sizeof(temp) - 1] = '\0';
+	strncat(temp, ".bundle", sizeof(temp) - strlen(temp) - 1);
+	return temp;
+}
+
 #ifndef SYNC_PLAYER
 
 #define CLIENT_GREET "hello, synctracker!"
@@ -101,14 +180,29 @@ static inline int sockio_send(struct sync_device *d, const void *buf, int len)
 	return d->sockio_cb.send(d->sockio_ctxt, buf, len) != len;
 }
 
+/* all of len bytes, also when they arrive split up */
 static inline int sockio_recv(struct sync_device *d, void *buf, int len)
 {
+	char *p = buf;
 	assert(len > 0);
-	return d->sockio_cb.recv(d->sockio_ctxt, buf, len) != len;
+	while (len > 0) {
+		int ret = d->sockio_cb.recv(d->sockio_ctxt, p, len);
+		if (ret <= 0)
+			return -1;
+		p += ret;
+		len -= ret;
+	}
+	return 0;
 }
 
+#ifdef USE_NET_THREAD
+static int start_net_thread(struct sync_device *);
+#endif
+static void stop_net_thread(struct sync_device *);
+
 static inline void sockio_close(struct sync_device *d)
 {
+	stop_net_thread(d);
 	d->sockio_cb.close(d->sockio_ctxt);
 	d->sockio_ctxt = NULL;
 }
@@ -122,8 +216,81 @@ void sync_set_io_cb(struct sync_device *d, struct sync_io_cb *cb)
 	d->io_cb.close = cb->close;
 }
 
+void sync_set_bake_resolution(struct sync_device *d, int rows_per_sample)
+{
+	assert(rows_per_sample >= 0);
+	d->bake_step = rows_per_sample;
+}
+
+size_t sync_get_baked_size(const struct sync_device *d)
+{
+	size_t i, size = 0;
+	for (i = 0; i < d->num_tracks; ++i)
+		size += sizeof(float) * d->tracks[i]->num_baked;
+	return size;
+}
+
 #endif
 
+#ifdef SYNC_PLAYER
+
+#define ARENA_BLOCK_SIZE (64 * 1024)
+#define ARENA_ALIGN 16
+
+struct arena_block {
+	struct arena_block *next;
+	size_t size, used;
+};
+
+#define ARENA_HEADER_SIZE \
+	((sizeof(struct arena_block) + ARENA_ALIGN - 1) & ~(size_t)(ARENA_ALIGN - 1))
+
+void *sync_arena_alloc(struct sync_arena *a, size_t size)
+{
+	struct arena_block *b = a->blocks;
+
+	size = (size + ARENA_ALIGN - 1) & ~(size_t)(ARENA_ALIGN - 1);
+	if (!b || b->size - b->used < size) {
+		size_t block_size = size > ARENA_BLOCK_SIZE ? size : ARENA_BLOCK_SIZE;
+		b = malloc(ARENA_HEADER_SIZE + block_size);
+		if (!b)
+			return NULL;
+		b->size = block_size;
+		b->used = 0;
+
+		/* keep filling the current block after a large allocation */
+		if (a->blocks && size > ARENA_BLOCK_SIZE / 4) {
+			b->next = a->blocks->next;
+			a->blocks->next = b;
+		} else {
+			b->next = a->blocks;
+			a->blocks = b;
+		}
+	}
+
+	b->used += size;
+	return (char *)b + ARENA_HEADER_SIZE + b->used - size;
+}
+
+static void arena_free(struct sync_arena *a)
+{
+	while (a->blocks) {
+		struct arena_block *b = a->blocks;
+		a->blocks = b->next;
+		free(b);
+	}
+}
+
+static char *arena_strdup(struct sync_arena *a, const char *str)
+{
+	char *ret = sync_arena_alloc(a, strlen(str) + 1);
+	if (ret)
+		strcpy(ret, str);
+	return ret;
+}
+
+#endif /* defined(SYNC_PLAYER) */
+
 #ifdef NEED_STRDUP
 static inline char *rocket_strdup(const char *str)
 {
@@ -152,10 +319,32 @@ struct sync_device *sync_create_device(const char *base)
 
 	d->tracks = NULL;
 	d->num_tracks = 0;
+	d->track_hash = NULL;
+	d->hash_size = 0;
+	d->groups = NULL;
+	d->num_groups = 0;
+	d->epoch = 1;
+	d->readers = NULL;
+	d->retired = NULL;
 
 #ifndef SYNC_PLAYER
 	d->row = -1;
+	d->row_queued = -1;
 	d->sockio_ctxt = NULL;
+	d->sockio_wait = NULL;
+	d->net_max_cmds = -1;
+	d->net = NULL;
+	d->recv_pos = d->recv_len = 0;
+	d->send_buf = NULL;
+	d->send_len = d->send_size = 0;
+	d->greeted = 0;
+	d->reconnect = NULL;
+#else
+	d->bake_step = 0;
+	d->arena.blocks = NULL;
+	d->bundle_state = BUNDLE_UNPROBED;
+	d->bundle = NULL;
+	d->bundle_size = 0;
 #endif
 
 	d->io_cb.open = (void *(*)(const char *, const char *))fopen;
@@ -167,48 +356,130 @@ struct sync_device *sync_create_device(const char *base)
 
 void sync_destroy_device(struct sync_device *d)
 {
+	size_t j;
+#ifndef SYNC_PLAYER
 	int i;
+#endif
+
+	while (d->retired) {
+		struct retired_snapshot *r = d->retired;
+		d->retired = r->next;
+		sync_free_snapshot(r->track);
+		free(r);
+	}
+	for (j = 0; j < d->num_tracks; ++j)
+		if (d->tracks[j]->snapshot)
+			sync_free_snapshot(d->tracks[j]->snapshot);
 
 #ifndef SYNC_PLAYER
 	if (d->sockio_ctxt)
 		sockio_close(d);
+	free(d->send_buf);
+	sync_tcp_free_reconnect(d->reconnect);
 
 	sync_tcp_device_dtor();
-#endif
 
 	for (i = 0; i < (int)d->num_tracks; ++i) {
 		free(d->tracks[i]->name);
 		free(d->tracks[i]->keys);
+		free(d->tracks[i]->segs);
+		free(d->tracks[i]->index);
 		free(d->tracks[i]);
 	}
+#else
+	arena_free(&d->arena);
+#ifdef USE_MMAP
+	if (d->bundle_state == BUNDLE_MAPPED)
+		munmap(d->bundle, d->bundle_size);
+#endif
+	if (d->bundle_state == BUNDLE_ALLOCATED)
+		free(d->bundle);
+#endif
+	for (j = 0; j < d->num_groups; ++j) {
+		free(d->groups[j]->segs);
+		free(d->groups[j]);
+	}
+	free(d->groups);
 	free(d->tracks);
+	free(d->track_hash);
 	free(d->base);
 	free(d);
 }
 
+/* derive everything evaluation needs from freshly loaded keys */
+static int prepare_track(struct sync_device *d, struct sync_track *t)
+{
+	if (sync_build_segs(t) || sync_build_index(t))
+		return -1;
+
+#ifdef SYNC_PLAYER
+	if (d->bake_step)
+		return sync_bake_track(t, d->bake_step);
+#endif
+	return 0;
+}
+
+/* row, value and type of a key, as written by save_track() */
+#define TRACK_KEY_SIZE (sizeof(int) + sizeof(float) + sizeof(char))
+
 static int read_track_data(struct sync_device *d, struct sync_track *t)
 {
-	int i;
+	int i, num_keys;
+	size_t size;
+	unsigned char *buf;
 	void *fp = d->io_cb.open(sync_track_path(d->base, t->name), "rb");
 	if (!fp)
 		return -1;
 
-	d->io_cb.read(&t->num_keys, sizeof(int), 1, fp);
-	t->keys = malloc(sizeof(struct track_key) * t->num_keys);
+	if (d->io_cb.read(&num_keys, sizeof(int), 1, fp) != 1 ||
+	    num_keys < 0 ||
+	    (size_t)num_keys > INT_MAX / sizeof(struct track_key))
+		goto err;
+	if (!num_keys) {
+		d->io_cb.close(fp);
+		return 0;
+	}
+
+#ifdef SYNC_PLAYER
+	t->keys = sync_arena_alloc(&d->arena,
+	    sizeof(struct track_key) * num_keys);
+#else
+	t->keys = malloc(sizeof(struct track_key) * num_keys);
+#endif
 	if (!t->keys)
-		return -1;
+		goto err;
+
+	/*
+	 * Read all packed keys into the start of the key array in one call.
+	 * Asking for one byte more than expected catches a file of the
+	 * wrong size without seeking.
+	 */
+	buf = (unsigned char *)t->keys;
+	size = TRACK_KEY_SIZE * num_keys;
+	if (d->io_cb.read(buf, 1, size + 1, fp) != size)
+		goto err;
+	d->io_cb.close(fp);
 
-	for (i = 0; i < (int)t->num_keys; ++i) {
-		struct track_key *key = t->keys + i;
-		char type;
-		d->io_cb.read(&key->row, sizeof(int), 1, fp);
-		d->io_cb.read(&key->value, sizeof(float), 1, fp);
-		d->io_cb.read(&type, sizeof(char), 1, fp);
-		key->type = (enum key_type)type;
+	/* unpack from the back, each key only overwrites decoded data */
+	for (i = num_keys - 1; i >= 0; --i) {
+		const unsigned char *src = buf + TRACK_KEY_SIZE * i;
+		struct track_key key;
+		memcpy(&key.row, src, sizeof(int));
+		memcpy(&key.value, src + sizeof(int), sizeof(float));
+		key.type = (enum key_type)(char)src[sizeof(int) + sizeof(float)];
+		t->keys[i] = key;
 	}
 
+	t->num_keys = t->capacity = num_keys;
+	return prepare_track(d, t);
+
+err:
+#ifndef SYNC_PLAYER
+	free(t->keys);
+#endif
+	t->keys = NULL;
 	d->io_cb.close(fp);
-	return 0;
+	return -1;
 }
 
 static int create_leading_dirs(const char *path)
@@ -277,8 +548,74 @@ int sync_save_tracks(const struct sync_device *d)
 	return 0;
 }
 
+/*
+ * Tracks go into bundles raw by default. A step of 0 packs them with exact
+ * values, a positive step also rounds values to multiples of it.
+ */
+int sync_set_precision(struct sync_device *d, const char *name, float step)
+{
+	int idx = find_track(d, name);
+	if (idx < 0)
+		return -1;
+	d->tracks[idx]->precision = step;
+	return 0;
+}
+
+int sync_save_bundle(const struct sync_device *d)
+{
+	const char *path = sync_bundle_path(d->base);
+	if (create_leading_dirs(path))
+		return -1;
+	return bundle_write(path, d->tracks, d->num_tracks);
+}
+
 #ifndef SYNC_PLAYER
 
+/*
+ * Requests are queued, and sent by sync_update() as far as the socket
+ * takes them without blocking, so that a slow editor does not stall the
+ * frame and the requests for all tracks go out in a few packets.
+ */
+static int queue_send(struct sync_device *d, const void *buf, int len)
+{
+	if (d->send_len + len > d->send_size) {
+		int size = d->send_size ? d->send_size : 1024;
+		void *tmp;
+		while (size < d->send_len + len)
+			size *= 2;
+		tmp = realloc(d->send_buf, size);
+		if (!tmp)
+			return -1;
+		d->send_buf = tmp;
+		d->send_size = size;
+	}
+	memcpy(d->send_buf + d->send_len, buf, len);
+	d->send_len += len;
+	return 0;
+}
+
+/* send what the socket takes for now, keeping the rest queued */
+static int flush_send(struct sync_device *d)
+{
+	int ret, writeable;
+
+	while (d->send_len) {
+		ret = sockio_poll(d, NULL, &writeable);
+		if (ret <= 0 || !writeable)
+			return ret < 0 ? -1 : 0;
+
+		ret = d->sockio_cb.send(d->sockio_ctxt, d->send_buf,
+		    d->send_len);
+		if (ret <= 0)
+			return -1;
+		d->send_len -= ret;
+		memmove(d->send_buf, d->send_buf + ret, d->send_len);
+		if (d->row_queued >= 0 && (d->row_queued -= ret) < 0)
+			d->row_queued = -1; /* on its way, leave it be */
+	}
+	return 0;
+}
+
 static int fetch_track_data(struct sync_device *d, struct sync_track *t)
 {
 	unsigned char cmd = GET_TRACK;
@@ -287,10 +624,10 @@ static int fetch_track_data(struct sync_device *d, struct sync_track *t)
 	assert(strlen(t->name) <= UINT32_MAX);
 	name_len = htonl((uint32_t)strlen(t->name));
 
-	/* send request data */
-	if (sockio_send(d, (char *)&cmd, 1) ||
-	    sockio_send(d, (char *)&name_len, sizeof(name_len)) ||
-	    sockio_send(d, t->name, (int)strlen(t->name)))
+	/* queue request data */
+	if (queue_send(d, (char *)&cmd, 1) ||
+	    queue_send(d, (char *)&name_len, sizeof(name_len)) ||
+	    queue_send(d, t->name, (int)strlen(t->name)))
 	{
 		sockio_close(d);
 		return -1;
@@ -299,80 +636,261 @@ static int fetch_track_data(struct sync_device *d, struct sync_track *t)
 	return 0;
 }
 
-static int handle_set_key_cmd(struct sync_device *d)
+/*
+ * SET_KEY commands for one track with ascending rows, as sent when the
+ * editor transfers a whole track, are collected and merged into the
+ * track in one go by sync_set_keys().
+ */
+#define MAX_KEY_RUN 256
+
+struct key_run {
+	uint32_t track;
+	int num_keys;
+	struct track_key keys[MAX_KEY_RUN];
+};
+
+static int flush_key_run(struct sync_device *d, struct key_run *run)
+{
+	int ret = 0;
+	if (run->num_keys)
+		ret = sync_set_keys(d->tracks[run->track], run->keys,
+		    run->num_keys);
+	run->num_keys = 0;
+	return ret;
+}
+
+/* an editor command, as read off the socket */
+struct net_cmd {
+	unsigned char cmd, flag;
+	uint32_t track;
+	struct track_key key; /* only the row for DELETE_KEY and SET_ROW */
+};
+
+#define NET_ERROR 0xff /* pseudo-command, the connection is gone */
+
+static uint32_t get_u32(const unsigned char *p)
 {
-	uint32_t track, row;
+	return (uint32_t)p[0] << 24 | (uint32_t)p[1] << 16 |
+	    (uint32_t)p[2] << 8 | p[3];
+}
+
+/* decode a command, returns its size, 0 if incomplete and -1 if bad */
+static int parse_cmd(const unsigned char *p, int len, struct net_cmd *c)
+{
+	/* by command, 0 for those the editor never sends */
+	static const int sizes[] = { 14, 9, 0, 5, 2, 1 };
 	union {
 		float f;
 		uint32_t i;
 	} v;
-	struct track_key key;
-	unsigned char type;
-
-	if (sockio_recv(d, (char *)&track, sizeof(track)) ||
-	    sockio_recv(d, (char *)&row, sizeof(row)) ||
-	    sockio_recv(d, (char *)&v.i, sizeof(v.i)) ||
-	    sockio_recv(d, (char *)&type, 1))
-		return -1;
-
-	track = ntohl(track);
-	v.i = ntohl(v.i);
 
-	key.row = ntohl(row);
-	key.value = v.f;
+	if (!len)
+		return 0;
 
-	if (type >= KEY_TYPE_COUNT || track >= d->num_tracks)
+	c->cmd = p[0];
+	if (c->cmd >= sizeof(sizes) / sizeof(sizes[0]) || !sizes[c->cmd]) {
+		fprintf(stderr, "unknown cmd: %02x\n", c->cmd);
 		return -1;
+	}
+	if (len < sizes[c->cmd])
+		return 0;
 
-	key.type = (enum key_type)type;
-	return sync_set_key(d->tracks[track], &key);
+	switch (c->cmd) {
+	case SET_KEY:
+		if (p[13] >= KEY_TYPE_COUNT)
+			return -1;
+		v.i = get_u32(p + 9);
+		c->key.value = v.f;
+		c->key.type = (enum key_type)p[13];
+		/* fall through */
+	case DELETE_KEY:
+		c->track = get_u32(p + 1);
+		c->key.row = get_u32(p + 5);
+		break;
+	case SET_ROW:
+		c->key.row = get_u32(p + 1);
+		break;
+	case PAUSE:
+		c->flag = p[1];
+		break;
+	}
+	return sizes[c->cmd];
 }
 
-static int handle_del_key_cmd(struct sync_device *d)
+/* read whatever has arrived in one go, returns 1 if anything did */
+static int fill_recv_buf(struct sync_device *d)
 {
-	uint32_t track, row;
+	int ret, readable;
+
+	ret = sockio_poll(d, &readable, NULL);
+	if (ret <= 0)
+		return ret < 0 ? -1 : 0;
+
+	/* keep the start of a command cut off by the last read */
+	d->recv_len -= d->recv_pos;
+	memmove(d->recv_buf, d->recv_buf + d->recv_pos, d->recv_len);
+	d->recv_pos = 0;
+
+	ret = d->sockio_cb.recv(d->sockio_ctxt, d->recv_buf + d->recv_len,
+	    RECV_BUF_SIZE - d->recv_len);
+	if (ret <= 0)
+		return -1; /* closed, if readable yet empty */
+	d->recv_len += ret;
+	return 1;
+}
 
-	if (sockio_recv(d, (char *)&track, sizeof(track)) ||
-	    sockio_recv(d, (char *)&row, sizeof(row)))
-		return -1;
+/*
+ * Decode the next command without consuming it, reading more once the
+ * buffer runs dry. Returns the size to add to recv_pos, 0 if no complete
+ * command is in and -1 on errors.
+ */
+static int peek_cmd(struct sync_device *d, struct net_cmd *c)
+{
+	int ret;
 
-	track = ntohl(track);
-	row = ntohl(row);
+	for (;;) {
+		ret = parse_cmd(d->recv_buf + d->recv_pos,
+		    d->recv_len - d->recv_pos, c);
+		if (ret)
+			return ret;
 
-	if (track >= d->num_tracks)
+		ret = fill_recv_buf(d);
+		if (ret <= 0)
+			return ret;
+	}
+}
+
+static int apply_cmd(struct sync_device *d, const struct net_cmd *c,
+    struct key_run *run, struct sync_cb *cb, void *cb_param)
+{
+	/* keep the commands in order */
+	if (c->cmd != SET_KEY && flush_key_run(d, run))
 		return -1;
 
-	return sync_del_key(d->tracks[track], row);
+	switch (c->cmd) {
+	case SET_KEY:
+		if (c->track >= d->num_tracks)
+			return -1;
+		if (run->num_keys && (run->track != c->track ||
+		    run->num_keys == MAX_KEY_RUN ||
+		    run->keys[run->num_keys - 1].row >= c->key.row) &&
+		    flush_key_run(d, run))
+			return -1;
+		run->track = c->track;
+		run->keys[run->num_keys++] = c->key;
+		break;
+	case DELETE_KEY:
+		if (c->track >= d->num_tracks)
+			return -1;
+		return sync_del_key(d->tracks[c->track], c->key.row);
+	case SET_ROW:
+		if (cb && cb->set_row)
+			cb->set_row(cb_param, c->key.row);
+		break;
+	case PAUSE:
+		if (cb && cb->pause)
+			cb->pause(cb_param, c->flag);
+		break;
+	case SAVE_TRACKS:
+		sync_save_tracks(d);
+		break;
+	default:
+		return -1;
+	}
+	return 0;
 }
 
-static int server_greet(struct sync_device *d)
+/*
+ * The handshake is split up so that sync_tcp_connect_async() can wait
+ * for the editor's greeting across calls to sync_update(). Until then,
+ * the device counts as not connected.
+ */
+int sync_begin_greet(struct sync_device *d, struct sync_sockio_cb *cb,
+    void *ctxt)
 {
-	char greet[128];
-	int i;
+	if (d->sockio_ctxt)
+		sockio_close(d);
+
+	d->sockio_cb = *cb;
+	d->sockio_ctxt = ctxt;
+	d->sockio_wait = NULL;
+	d->greeted = 0;
+	d->recv_pos = d->recv_len = 0;
+	d->send_len = 0;
+	d->row_queued = -1;
 
-	if (sockio_send(d, CLIENT_GREET, (int)strlen(CLIENT_GREET)) ||
-	    sockio_recv(d, greet, (int)strlen(SERVER_GREET)) ||
-	    strncmp(SERVER_GREET, greet, strlen(SERVER_GREET))) {
+	if (sockio_send(d, CLIENT_GREET, (int)strlen(CLIENT_GREET))) {
 		sockio_close(d);
 		return -1;
 	}
+	return 0;
+}
+
+static int finish_greet(struct sync_device *d)
+{
+	int i;
 
 	for (i = 0; i < (int)d->num_tracks; ++i) {
 		free(d->tracks[i]->keys);
+		free(d->tracks[i]->segs);
+		free(d->tracks[i]->index);
 		d->tracks[i]->keys = NULL;
+		d->tracks[i]->segs = NULL;
+		d->tracks[i]->index = NULL;
 		d->tracks[i]->num_keys = 0;
+		d->tracks[i]->capacity = 0;
+		d->tracks[i]->kind = TRACK_CONSTANT;
+		d->tracks[i]->serial++;
 	}
 
 	for (i = 0; i < (int)d->num_tracks; ++i) {
-		if (fetch_track_data(d, d->tracks[i])) {
-			sockio_close(d);
+		if (fetch_track_data(d, d->tracks[i]))
 			return -1;
-		}
 	}
 
+	if (flush_send(d)) {
+		sockio_close(d);
+		return -1;
+	}
+
+	d->greeted = 1;
+#ifdef USE_NET_THREAD
+	if (d->net_max_cmds >= 0)
+		start_net_thread(d);
+#endif
 	return 0;
 }
 
+/* returns 1 once greeted, 0 while waiting and -1 when disconnected */
+int sync_poll_greet(struct sync_device *d)
+{
+	int ret, len = (int)strlen(SERVER_GREET);
+
+	while (d->recv_len < len) {
+		ret = fill_recv_buf(d);
+		if (ret < 0)
+			goto fail;
+		if (!ret)
+			return 0;
+	}
+
+	/* what follows the greeting are commands */
+	if (memcmp(SERVER_GREET, d->recv_buf, len))
+		goto fail;
+	d->recv_pos = len;
+	return finish_greet(d) ? -1 : 1;
+
+fail:
+	sockio_close(d);
+	return -1;
+}
+
+void sync_drop_connection(struct sync_device *d)
+{
+	if (d->sockio_ctxt)
+		sockio_close(d);
+}
+
 /* Setting a new cb+ctxt establishes a new abstract connection represented by ctxt.
  * How the connection communicates is implemented by the .recv()/.send() members.
  * How the connection ends and cleans itself up is implemented by .close().
@@ -392,74 +910,300 @@ int sync_set_sockio_cb(struct sync_device *d, struct sync_sockio_cb *cb, void *c
 	assert(cb->recv);
 	assert(cb->close);
 
-	if (d->sockio_ctxt)
+	if (sync_begin_greet(d, cb, ctxt))
+		return -1;
+
+	/* wait for the greeting */
+	if (sockio_recv(d, d->recv_buf, (int)strlen(SERVER_GREET))) {
 		sockio_close(d);
+		return -1;
+	}
+	d->recv_len = (int)strlen(SERVER_GREET);
+	return sync_poll_greet(d) > 0 ? 0 : -1;
+}
 
-	d->sockio_cb = *cb;
-	d->sockio_ctxt = ctxt;
+static void finish_edits(struct sync_device *d)
+{
+	int i;
+	for (i = 0; i < (int)d->num_tracks; ++i) {
+		struct sync_track *t = d->tracks[i];
+		if (t->kind == TRACK_UNCLASSIFIED)
+			sync_classify_track(t);
+		/* on failure, lookups fall back to a binary search */
+		if (!t->index && t->num_keys >= INDEX_MIN_KEYS)
+			sync_build_index(t);
+	}
+}
+
+/*
+ * With the net thread, the socket is read and commands decoded on a
+ * thread of the library's own, and handed to sync_update() through a
+ * single-producer, single-consumer ring. Only sync_update() touches the
+ * tracks and calls back into the application.
+ */
+#ifdef USE_NET_THREAD
+
+#define NET_QUEUE_SIZE 1024 /* a power of two */
+#define NET_WAIT_MS 20 /* how long a stop may go unnoticed when idle */
+
+struct net_thread {
+	net_thread_handle thread;
+	int running;
+	volatile int stop;
+	volatile unsigned head, tail; /* written by the thread, and by us */
+	struct net_cmd cmds[NET_QUEUE_SIZE];
+};
+
+static void sleep_ms(int ms)
+{
+#ifdef _WIN32
+	Sleep(ms);
+#else
+	struct timespec ts;
+	ts.tv_sec = ms / 1000;
+	ts.tv_nsec = ms % 1000 * 1000000L;
+	nanosleep(&ts, NULL);
+#endif
+}
+
+/* until more may have arrived, blocking on the socket where we can */
+static void wait_readable(struct sync_device *d)
+{
+	if (d->sockio_wait)
+		d->sockio_wait(d->sockio_ctxt, NET_WAIT_MS);
+	else
+		sleep_ms(1);
+}
+
+static int net_push(struct net_thread *n, const struct net_cmd *c)
+{
+	unsigned head = n->head;
+	if (head - atomic_load_acquire(&n->tail) == NET_QUEUE_SIZE)
+		return 0;
+	n->cmds[head % NET_QUEUE_SIZE] = *c;
+	atomic_store_release(&n->head, head + 1);
+	return 1;
+}
+
+#ifdef _WIN32
+static DWORD WINAPI net_main(LPVOID arg)
+#else
+static void *net_main(void *arg)
+#endif
+{
+	struct sync_device *d = arg;
+	struct net_thread *n = d->net;
+	struct net_cmd c;
+	int ret;
+
+	while (!atomic_load_acquire(&n->stop)) {
+		ret = peek_cmd(d, &c);
+		if (!ret) {
+			wait_readable(d);
+			continue;
+		}
+		if (ret < 0)
+			c.cmd = NET_ERROR;
+
+		/*
+		 * Wait for sync_update() to make room. A command is only
+		 * consumed once queued, so when stopped, sync_update() reads
+		 * on from it.
+		 */
+		while (!net_push(n, &c)) {
+			if (atomic_load_acquire(&n->stop))
+				return 0;
+			sleep_ms(1);
+		}
+		if (c.cmd == NET_ERROR)
+			break;
+		d->recv_pos += ret;
+	}
+	return 0;
+}
+
+static int start_net_thread(struct sync_device *d)
+{
+	/* commands queued before a stop are still to be applied */
+	struct net_thread *n = d->net ? d->net : malloc(sizeof(*n));
+	if (!n)
+		return -1;
+
+	if (!d->net) {
+		n->head = n->tail = 0;
+		d->net = n;
+	}
+	n->stop = 0;
+#ifdef _WIN32
+	n->thread = CreateThread(NULL, 0, net_main, d, 0, NULL);
+	n->running = n->thread != NULL;
+#else
+	n->running = !pthread_create(&n->thread, NULL, net_main, d);
+#endif
+	return n->running ? 0 : -1;
+}
+
+static void join_net_thread(struct net_thread *n)
+{
+	if (!n->running)
+		return;
+
+	atomic_store_release(&n->stop, 1);
+#ifdef _WIN32
+	WaitForSingleObject(n->thread, INFINITE);
+	CloseHandle(n->thread);
+#else
+	pthread_join(n->thread, NULL);
+#endif
+	n->running = 0;
+}
+
+#endif /* defined(USE_NET_THREAD) */
+
+static void stop_net_thread(struct sync_device *d)
+{
+#ifdef USE_NET_THREAD
+	if (!d->net)
+		return;
+	join_net_thread(d->net);
+	free(d->net);
+	d->net = NULL;
+#else
+	(void)d;
+#endif
+}
+
+int sync_set_net_thread(struct sync_device *d, int max_cmds)
+{
+#ifdef USE_NET_THREAD
+	d->net_max_cmds = max_cmds;
+	if (!d->sockio_ctxt || !d->greeted)
+		return 0;
+	if (max_cmds < 0 && d->net)
+		join_net_thread(d->net);
+	else if (max_cmds >= 0 && (!d->net || !d->net->running))
+		/* on failure, sync_update() just reads the socket itself */
+		start_net_thread(d);
+	return 0;
+#else
+	(void)d;
+	(void)max_cmds;
+	return -1;
+#endif
+}
+
+void sync_set_sockio_wait(struct sync_device *d,
+    int (*wait)(void *ctxt, int timeout_ms))
+{
+#ifdef USE_NET_THREAD
+	/* the net thread calls it, so swap it while the thread is stopped */
+	int running = d->net && d->net->running;
+	if (running)
+		join_net_thread(d->net);
+	d->sockio_wait = wait;
+	if (running)
+		start_net_thread(d);
+#else
+	d->sockio_wait = wait;
+#endif
+}
 
-	return server_greet(d);
+/* fetch the next command, returns 1 if there is one and -1 on errors */
+static int next_cmd(struct sync_device *d, struct net_cmd *c)
+{
+	int ret;
+
+#ifdef USE_NET_THREAD
+	if (d->net) {
+		struct net_thread *n = d->net;
+		unsigned tail = n->tail;
+		if (tail != atomic_load_acquire(&n->head)) {
+			*c = n->cmds[tail % NET_QUEUE_SIZE];
+			atomic_store_release(&n->tail, tail + 1);
+			return c->cmd == NET_ERROR ? -1 : 1;
+		}
+		if (n->running)
+			return 0;
+
+		/* stopped and drained, read the socket from here on */
+		free(n);
+		d->net = NULL;
+	}
+#endif
+
+	ret = peek_cmd(d, c);
+	if (ret > 0) {
+		d->recv_pos += ret;
+		return 1;
+	}
+	return ret;
 }
 
 int sync_update(struct sync_device *d, int row, struct sync_cb *cb,
     void *cb_param)
 {
-	int readable;
+	int ret, budget, edited = 0;
+	struct key_run run;
+	struct net_cmd c;
 
+	if (d->reconnect && (!d->sockio_ctxt || !d->greeted) &&
+	    sync_tcp_reconnect(d))
+		return -1;
 	if (!d->sockio_ctxt)
 		return -1;
 
-	/* look for new commands */
-	while (sockio_poll(d, &readable, NULL) > 0) {
-		unsigned char cmd = 0, flag;
-		uint32_t new_row;
+	run.num_keys = 0;
+	budget = d->net && d->net_max_cmds > 0 ? d->net_max_cmds : 0;
 
-		if (sockio_recv(d, (char *)&cmd, 1))
+	/* look for new commands */
+	while ((ret = next_cmd(d, &c)) > 0) {
+		if (apply_cmd(d, &c, &run, cb, cb_param))
 			goto sockerr;
-
-		switch (cmd) {
-		case SET_KEY:
-			if (handle_set_key_cmd(d))
-				goto sockerr;
-			break;
-		case DELETE_KEY:
-			if (handle_del_key_cmd(d))
-				goto sockerr;
-			break;
-		case SET_ROW:
-			if (sockio_recv(d, (char *)&new_row, sizeof(new_row)))
-				goto sockerr;
-			if (cb && cb->set_row)
-				cb->set_row(cb_param, ntohl(new_row));
-			break;
-		case PAUSE:
-			if (sockio_recv(d, (char *)&flag, 1))
-				goto sockerr;
-			if (cb && cb->pause)
-				cb->pause(cb_param, flag);
-			break;
-		case SAVE_TRACKS:
-			sync_save_tracks(d);
+		if (c.cmd == SET_KEY || c.cmd == DELETE_KEY)
+			edited = 1;
+		if (budget && !--budget)
 			break;
-		default:
-			fprintf(stderr, "unknown cmd: %02x\n", cmd);
-			goto sockerr;
-		}
 	}
+	if (ret < 0)
+		goto sockerr;
+
+	if (flush_key_run(d, &run))
+		goto sockerr;
+
+	/*
+	 * Edits drop the kind, and the search index of large tracks, rather
+	 * than scan all keys each, see sync_set_key()
+	 */
+	if (edited)
+		finish_edits(d);
 
 	if (cb && cb->is_playing && cb->is_playing(cb_param)) {
 		if (d->row != row && d->sockio_ctxt) {
 			unsigned char cmd = SET_ROW;
 			uint32_t nrow = htonl(row);
-			if (sockio_send(d, (char*)&cmd, 1) ||
-			    sockio_send(d, (char*)&nrow, sizeof(nrow)))
-				goto sockerr;
+
+			/* a blocked editor gets the latest row, not one per frame */
+			if (d->row_queued >= 0)
+				memcpy(d->send_buf + d->row_queued + 1, &nrow,
+				    sizeof(nrow));
+			else {
+				d->row_queued = d->send_len;
+				if (queue_send(d, (char*)&cmd, 1) ||
+				    queue_send(d, (char*)&nrow, sizeof(nrow)))
+					goto sockerr;
+			}
 			d->row = row;
 		}
 	}
+
+	if (flush_send(d))
+		goto sockerr;
 	return 0;
 
 sockerr:
+	flush_key_run(d, &run);
+	if (edited)
+		finish_edits(d);
 	sockio_close(d);
 	return -1;
 }
@@ -472,31 +1216,236 @@ static int create_track(struct sync_device *d, const char *name)
 	struct sync_track *t;
 	assert(find_track(d, name) < 0);
 
+	/* grow the track list geometrically, its size is a power of two */
+	if (!(d->num_tracks & (d->num_tracks - 1))) {
+		tmp = realloc(d->tracks, sizeof(d->tracks[0]) *
+		    (d->num_tracks ? 2 * d->num_tracks : 1));
+		if (!tmp)
+			return -1;
+		d->tracks = tmp;
+	}
+
+#ifdef SYNC_PLAYER
+	t = sync_arena_alloc(&d->arena, sizeof(*t));
+	if (!t)
+		return -1;
+
+	t->name = arena_strdup(&d->arena, name);
+	t->arena = &d->arena;
+#else
 	t = malloc(sizeof(*t));
 	if (!t)
 		return -1;
 
 	t->name = strdup(name);
+#endif
+	if (!t->name)
+		goto err;
+
 	t->keys = NULL;
+	t->segs = NULL;
+	t->index = NULL;
 	t->num_keys = 0;
+	t->capacity = 0;
+	t->cursor = -1;
+	t->kind = TRACK_CONSTANT; /* no keys */
+	t->serial = 0;
+	t->frame_serial = t->serial - 1; /* nothing cached */
+	t->frame_seg = -1;
+	t->frame_row = t->frame_val = 0.0;
+	t->snapshot = NULL;
+	t->precision = -1.0f;
+#ifdef SYNC_PLAYER
+	t->baked = NULL;
+	t->num_baked = 0;
+#endif
+
+	d->tracks[d->num_tracks] = t;
+	if (add_track_hash(d, (int)d->num_tracks))
+		goto err;
+
+	return (int)d->num_tracks++;
+
+err:
+#ifndef SYNC_PLAYER
+	free(t->name);
+	free(t);
+#endif
+	return -1;
+}
+
+#ifdef SYNC_PLAYER
+
+/* create a track for every valid bundle entry, using keys in place */
+static int add_bundle_tracks(struct sync_device *d, const void *buf,
+    size_t len)
+{
+	uint32_t i, num_tracks;
+
+	if (bundle_open(buf, len, &num_tracks))
+		return -1;
+
+	for (i = 0; i < num_tracks; ++i) {
+		struct bundle_entry e;
+		struct sync_track *t;
+		int idx;
+
+		if (bundle_get_entry(buf, len, i, &e) ||
+		    find_track(d, e.name) >= 0)
+			continue;
+
+		idx = create_track(d, e.name);
+		if (idx < 0)
+			return -1;
+		t = d->tracks[idx];
+
+		/* the player never writes to keys */
+		t->keys = (struct track_key *)bundle_keys_in_place(&e);
+		if (!t->keys) {
+			t->keys = sync_arena_alloc(&d->arena,
+			    sizeof(struct track_key) * e.num_keys);
+			if (!t->keys)
+				return -1;
+			if (bundle_decode_keys(&e, t->keys)) {
+				/* fall back to the .track file */
+				t->keys = NULL;
+				read_track_data(d, t);
+				continue;
+			}
+		}
+		t->num_keys = t->capacity = (int)e.num_keys;
+
+		if (prepare_track(d, t))
+			return -1;
+	}
+	return 0;
+}
+
+#ifdef USE_MMAP
+static void *map_file(const char *path, size_t *len)
+{
+	struct stat st;
+	void *ptr;
+	int fd = open(path, O_RDONLY);
+	if (fd < 0)
+		return NULL;
+
+	if (fstat(fd, &st) || !st.st_size) {
+		close(fd);
+		return NULL;
+	}
+
+	ptr = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (ptr == MAP_FAILED)
+		return NULL;
+
+	*len = (size_t)st.st_size;
+	return ptr;
+}
+#endif
+
+/*
+ * With the default stdio callbacks the bundle is memory-mapped where
+ * available, otherwise it is read with one call after the header.
+ */
+static int load_bundle(struct sync_device *d)
+{
+	const char *path = sync_bundle_path(d->base);
+	unsigned char header[BUNDLE_HEADER_SIZE];
+	uint32_t num_tracks;
+	size_t rest;
+	void *fp;
+
+#ifdef USE_MMAP
+	if (d->io_cb.open == (void *(*)(const char *, const char *))fopen) {
+		d->bundle = map_file(path, &d->bundle_size);
+		if (!d->bundle)
+			return -1;
+		if (bundle_open(d->bundle, d->bundle_size, &num_tracks)) {
+			munmap(d->bundle, d->bundle_size);
+			d->bundle = NULL;
+			return -1;
+		}
+		d->bundle_state = BUNDLE_MAPPED;
+		return add_bundle_tracks(d, d->bundle, d->bundle_size);
+	}
+#endif
 
-	tmp = realloc(d->tracks, sizeof(d->tracks[0]) * (d->num_tracks + 1));
-	if (!tmp) {
-		free(t);
+	fp = d->io_cb.open(path, "rb");
+	if (!fp)
+		return -1;
+
+	if (d->io_cb.read(header, 1, sizeof(header), fp) != sizeof(header) ||
+	    memcmp(header, BUNDLE_MAGIC, 4)) {
+		d->io_cb.close(fp);
 		return -1;
 	}
 
-	d->tracks = tmp;
-	d->tracks[d->num_tracks++] = t;
+	/* the header carries the file size */
+	d->bundle_size = (size_t)header[12] | (size_t)header[13] << 8 |
+	    (size_t)header[14] << 16 | (size_t)header[15] << 24;
+	d->bundle = d->bundle_size >= sizeof(header) ?
+	    malloc(d->bundle_size) : NULL;
+	if (!d->bundle) {
+		d->io_cb.close(fp);
+		return -1;
+	}
+
+	rest = d->bundle_size - sizeof(header);
+	memcpy(d->bundle, header, sizeof(header));
+	if (d->io_cb.read((char *)d->bundle + sizeof(header), 1, rest,
+	    fp) != rest ||
+	    bundle_open(d->bundle, d->bundle_size, &num_tracks)) {
+		d->io_cb.close(fp);
+		free(d->bundle);
+		d->bundle = NULL;
+		return -1;
+	}
+	d->io_cb.close(fp);
+
+	d->bundle_state = BUNDLE_ALLOCATED;
+	return add_bundle_tracks(d, d->bundle, d->bundle_size);
+}
+
+int sync_load_bundle(struct sync_device *d)
+{
+	/* a device takes its tracks from one bundle at most */
+	if (d->bundle)
+		return -1;
+	return load_bundle(d);
+}
+
+int sync_load_tracks_from_memory(struct sync_device *d, const void *buf,
+    size_t len)
+{
+	if (add_bundle_tracks(d, buf, len))
+		return -1;
 
-	return (int)d->num_tracks - 1;
+	/* only a valid bundle stops us from reading the .track files */
+	if (d->bundle_state == BUNDLE_UNPROBED) {
+		d->bundle_state = BUNDLE_MEMORY;
+		d->bundle = (void *)buf;
+		d->bundle_size = len;
+	}
+	return 0;
 }
 
+#endif /* defined(SYNC_PLAYER) */
+
 const struct sync_track *sync_get_track(struct sync_device *d,
     const char *name)
 {
 	struct sync_track *t;
-	int idx = find_track(d, name);
+	int idx;
+
+#ifdef SYNC_PLAYER
+	/* from here on, tracks missing from a bundle are read from disk */
+	if (d->bundle_state == BUNDLE_UNPROBED)
+		d->bundle_state = BUNDLE_NONE;
+#endif
+
+	idx = find_track(d, name);
 	if (idx >= 0)
 		return d->tracks[idx];
 
@@ -507,11 +1456,169 @@ const struct sync_track *sync_get_track(struct sync_device *d,
 	t = d->tracks[idx];
 
 #ifndef SYNC_PLAYER
-	if (d->sockio_ctxt)
+	if (d->sockio_ctxt && d->greeted)
 		fetch_track_data(d, t);
 	else
+#else
+	if (d->bundle_state != BUNDLE_MEMORY)
 #endif
 		read_track_data(d, t);
 
 	return t;
 }
+
+void sync_begin_frame(struct sync_device *d, double row)
+{
+	size_t i;
+	for (i = 0; i < d->num_tracks; ++i)
+		sync_cache_val(d->tracks[i], row);
+}
+
+struct sync_reader *sync_create_reader(struct sync_device *d)
+{
+	struct sync_reader *r = malloc(sizeof(*r));
+	if (!r)
+		return NULL;
+	r->device = d;
+	r->epoch = 0;
+	r->next = d->readers;
+	d->readers = r;
+	return r;
+}
+
+void sync_destroy_reader(struct sync_reader *r)
+{
+	struct sync_reader **p = &r->device->readers;
+	while (*p != r)
+		p = &(*p)->next;
+	*p = r->next;
+	free(r);
+}
+
+/*
+ * Announce the epoch we read in before looking at any snapshot. The
+ * fence pairs with the one in sync_publish(): either it sees our epoch,
+ * or we see the snapshots it published.
+ */
+void sync_read_begin(struct sync_reader *r)
+{
+	atomic_store_release(&r->epoch,
+	    atomic_load_acquire(&r->device->epoch));
+	atomic_fence();
+}
+
+void sync_read_end(struct sync_reader *r)
+{
+	atomic_store_release(&r->epoch, 0u);
+}
+
+const struct sync_track *sync_read_track(const struct sync_track *t)
+{
+	return atomic_load_acquire(&t->snapshot);
+}
+
+/* free the snapshots no reader can still be looking at */
+static void reclaim_snapshots(struct sync_device *d)
+{
+	struct retired_snapshot **p = &d->retired;
+	struct sync_reader *r;
+	unsigned oldest = d->epoch;
+
+	for (r = d->readers; r; r = r->next) {
+		unsigned epoch = atomic_load_acquire(&r->epoch);
+		if (epoch && epoch < oldest)
+			oldest = epoch;
+	}
+
+	while (*p) {
+		struct retired_snapshot *rs = *p;
+		if (rs->epoch < oldest) {
+			*p = rs->next;
+			sync_free_snapshot(rs->track);
+			free(rs);
+		} else
+			p = &rs->next;
+	}
+}
+
+int sync_publish(struct sync_device *d)
+{
+	size_t i;
+	int ret = 0;
+
+	for (i = 0; i < d->num_tracks; ++i) {
+		struct sync_track *t = d->tracks[i], *s, *old = t->snapshot;
+		struct retired_snapshot *rs = NULL;
+
+		if (old && old->serial == t->serial)
+			continue;
+
+		/* keep the old snapshot rather than fail to retire it */
+		if (old && !(rs = malloc(sizeof(*rs)))) {
+			ret = -1;
+			continue;
+		}
+		s = sync_snapshot_track(t);
+		if (!s) {
+			free(rs);
+			ret = -1;
+			continue;
+		}
+
+		atomic_store_release(&t->snapshot, s);
+		if (rs) {
+			rs->track = old;
+			rs->epoch = d->epoch;
+			rs->next = d->retired;
+			d->retired = rs;
+		}
+	}
+
+	atomic_store_release(&d->epoch, d->epoch + 1);
+	atomic_fence();
+	reclaim_snapshots(d);
+	return ret;
+}
+
+const struct sync_group *sync_get_group(struct sync_device *d,
+    const struct sync_track **tracks, int num_tracks)
+{
+	struct sync_group *g, **groups;
+	size_t i;
+
+	if (num_tracks <= 0)
+		return NULL;
+	for (i = 0; i < (size_t)num_tracks; ++i)
+		if (!tracks[i])
+			return NULL;
+
+	for (i = 0; i < d->num_groups; ++i) {
+		g = d->groups[i];
+		if (g->num_tracks == num_tracks && !memcmp(g->tracks, tracks,
+		    sizeof(*tracks) * num_tracks))
+			return g;
+	}
+
+	groups = realloc(d->groups, sizeof(*groups) * (d->num_groups + 1));
+	if (!groups)
+		return NULL;
+	d->groups = groups;
+
+	/* the track and serial arrays follow the group itself */
+	g = malloc(sizeof(*g) + (sizeof(*g->tracks) + sizeof(*g->serials)) *
+	    num_tracks);
+	if (!g)
+		return NULL;
+	g->tracks = (const struct sync_track **)(g + 1);
+	g->num_tracks = num_tracks;
+	g->serials = (unsigned *)(g->tracks + num_tracks);
+	g->segs = NULL;
+	memcpy(g->tracks, tracks, sizeof(*tracks) * num_tracks);
+
+	if (sync_build_group(g)) {
+		free(g);
+		return NULL;
+	}
+	d->groups[d->num_groups++] = g;
+	return g;
+}
@@ -56,19 +56,104 @@
  #define closesocket(x) close(x)
 #endif
 
+/* commands are read on a thread of our own, see sync_set_net_thread() */
+#if defined(_WIN32)
+ #define USE_NET_THREAD
+ typedef HANDLE net_thread_handle;
+#elif defined(USE_PTHREAD)
+ #define USE_NET_THREAD
+ #include <pthread.h>
+ typedef pthread_t net_thread_handle;
+#endif
+
+struct net_thread;
+struct tcp_reconnect;
+
+/* editor commands are read in bulk into this, see peek_cmd() */
+#define RECV_BUF_SIZE 8192
+
 #endif /* !defined(SYNC_PLAYER) */
 
+#ifdef SYNC_PLAYER
+/*
+ * Player builds never edit keys, so all per-track memory is carved out of
+ * a few large blocks owned by the device, and freed together.
+ */
+struct arena_block;
+
+struct sync_arena {
+	struct arena_block *blocks;
+};
+#endif
+
+/*
+ * Snapshots replaced by sync_publish() are kept until no reader that
+ * might still see them is between sync_read_begin() and sync_read_end().
+ */
+struct sync_reader {
+	struct sync_device *device;
+	volatile unsigned epoch; /* of sync_read_begin(), or 0 */
+	struct sync_reader *next;
+};
+
+struct retired_snapshot {
+	struct sync_track *track;
+	unsigned epoch; /* of the sync_publish() that replaced it */
+	struct retired_snapshot *next;
+};
+
+struct track_slot {
+	uint32_t hash;
+	int track; /* index into tracks plus one, 0 when empty */
+};
+
 struct sync_device {
 	char *base;
 	struct sync_track **tracks;
 	size_t num_tracks;
+	struct track_slot *track_hash; /* open addressing, see find_track() */
+	size_t hash_size;
+	struct sync_group **groups;
+	size_t num_groups;
+	volatile unsigned epoch; /* bumped by sync_publish(), never 0 */
+	struct sync_reader *readers;
+	struct retired_snapshot *retired;
 
 #ifndef SYNC_PLAYER
 	int row;
+	int row_queued; /* send_buf offset of the unsent SET_ROW, or -1 */
 	struct sync_sockio_cb sockio_cb;
 	void *sockio_ctxt;
+	int (*sockio_wait)(void *, int); /* see sync_set_sockio_wait() */
+	int net_max_cmds; /* negative when sync_update() reads the socket */
+	struct net_thread *net; /* running while connected, if enabled */
+	unsigned char recv_buf[RECV_BUF_SIZE]; /* the net thread's when running */
+	int recv_pos, recv_len; /* of the next command, and of the data */
+	unsigned char *send_buf; /* requests flush_send() has yet to send */
+	int send_len, send_size;
+	int greeted; /* the handshake is through, see sync_begin_greet() */
+	struct tcp_reconnect *reconnect; /* see sync_tcp_connect_async() */
+#else
+	int bake_step;
+	struct sync_arena arena;
+	enum {
+		BUNDLE_UNPROBED, /* until the first sync_get_track() */
+		BUNDLE_NONE,
+		BUNDLE_ALLOCATED,
+		BUNDLE_MAPPED,
+		BUNDLE_MEMORY /* owned by the application */
+	} bundle_state;
+	void *bundle; /* see sync_load_bundle() */
+	size_t bundle_size;
 #endif
 	struct sync_io_cb io_cb;
 };
 
+#ifndef SYNC_PLAYER
+/* the handshake of sync_set_sockio_cb(), for tcp.c to do step by step */
+int sync_begin_greet(struct sync_device *, struct sync_sockio_cb *, void *);
+int sync_poll_greet(struct sync_device *);
+void sync_drop_connection(struct sync_device *);
+#endif
+
 #endif /* SYNC_DEVICE_H */
@@ -21,6 +21,7 @@ extern "C" {
 
 struct sync_device;
 struct sync_track;
+struct sync_group;
 
 struct sync_device *sync_create_device(const char *);
 void sync_destroy_device(struct sync_device *);
@@ -33,9 +34,31 @@ struct sync_cb {
 };
 #define SYNC_DEFAULT_PORT 1338
 int sync_tcp_connect(struct sync_device *, const char *, unsigned short);
+
+/*
+ * Connect in the background instead: whenever the device is not
+ * connected from now on, sync_update() takes a step towards connecting
+ * to host without blocking, and returns -1 until it is through. Failed
+ * attempts are retried after a delay that doubles each time, up to a
+ * few seconds. host is looked up here, once; returns -1 if that fails.
+ */
+int sync_tcp_connect_async(struct sync_device *, const char *, unsigned short);
 int SYNC_DEPRECATED("use sync_tcp_connect instead") sync_connect(struct sync_device *, const char *, unsigned short);
 int sync_update(struct sync_device *, int, struct sync_cb *, void *);
 int sync_save_tracks(const struct sync_device *);
+int sync_save_bundle(const struct sync_device *);
+int sync_set_precision(struct sync_device *, const char *, float);
+
+/*
+ * Leave reading and decoding editor commands to a thread of the
+ * library's own. sync_update() then applies at most max_cmds of the
+ * commands that have arrived per call, or all of them when max_cmds is
+ * 0, and still calls back on the caller's thread. A negative max_cmds
+ * goes back to reading the socket in sync_update(). Returns -1 where
+ * threads are not supported. The sockio callbacks must allow a poll
+ * and send while another thread polls and receives, as sockets do.
+ */
+int sync_set_net_thread(struct sync_device *, int max_cmds);
 
 struct sync_sockio_cb {
 	/* Poll for ctxt send/recv readiness, returns:
@@ -56,7 +79,10 @@ struct sync_sockio_cb {
 	 * -errno on error,
 	 * +n_bytes-sent on success.
 	 *
-	 * May block to send all bytes, may send less than len in exceptions like signals/disconnects etc.
+	 * Requests are queued and sent once poll() reports ctxt writeable: send must then send what
+	 * fits without blocking, as send() on a non-blocking socket does, and may return less than len;
+	 * the rest is sent on a later sync_update(). Only the greeting, a few bytes on a new connection,
+	 * is sent without polling first and must go out whole.
 	 */
 	int (*send)(void *ctxt, const void *buf, int len);
 
@@ -64,7 +90,10 @@ struct sync_sockio_cb {
 	 * -errno on error,
 	 * +n_bytes-received on success.
 	 *
-	 * May block to receive len bytes, may return less than len in exceptions like signals/disconnects etc.
+	 * Commands are read in bulk once poll() reports ctxt readable: recv must then return the bytes
+	 * that have arrived, as recv() on a socket does, and never block waiting for len of them; it
+	 * is called again once poll() reports more. Returning 0 is taken as a disconnect. Only
+	 * sync_set_sockio_cb() calls recv without polling, where it may block for the greeting.
 	 */
 	int (*recv)(void *ctxt, void *buf, int len);
 
@@ -72,6 +101,43 @@ struct sync_sockio_cb {
 	void (*close)(void *ctxt);
 };
 int sync_set_sockio_cb(struct sync_device *d, struct sync_sockio_cb *cb, void *ctxt);
+
+/*
+ * Let an idle net thread block in wait for up to timeout_ms until ctxt is
+ * readable, rather than poll every millisecond. wait returns as poll()
+ * does. Every new connection resets it to NULL, so set it after
+ * sync_set_sockio_cb(); the TCP transport sets its own.
+ */
+void sync_set_sockio_wait(struct sync_device *,
+    int (*wait)(void *ctxt, int timeout_ms));
+#else
+/* Bake tracks loaded from now on into tables sampled every rows_per_sample
+ * rows. sync_get_val then only interpolates linearly between two samples,
+ * trading memory (4 bytes per sample) for exactness. 0 disables baking.
+ * Tracks whose keys span too many samples for a table stay unbaked.
+ */
+void sync_set_bake_resolution(struct sync_device *, int rows_per_sample);
+size_t sync_get_baked_size(const struct sync_device *);
+
+/*
+ * Load the tracks sync_save_bundle() wrote to <base>.bundle with one open,
+ * rather than one per track, memory-mapping it where possible. The editor
+ * only saves .track files, so only load a bundle known to be current,
+ * e.g. in a release build. Tracks missing from it, or that fail to
+ * decode, are still read from their .track files. Returns -1 without a
+ * valid bundle, or if the device has one already.
+ */
+int sync_load_bundle(struct sync_device *);
+
+/*
+ * Load the tracks of a bundle written by sync_save_bundle() from memory,
+ * e.g. linked into the executable or unpacked at startup. buf must outlive
+ * the device, keys are used in place when it is 4-byte aligned. When
+ * called before the first sync_get_track(), tracks missing from buf stay
+ * empty instead of being looked for on disk.
+ */
+int sync_load_tracks_from_memory(struct sync_device *, const void *buf,
+    size_t len);
 #endif /* defined(SYNC_PLAYER) */
 
 struct sync_io_cb {
@@ -84,6 +150,54 @@ void sync_set_io_cb(struct sync_device *d, struct sync_io_cb *cb);
 const struct sync_track *sync_get_track(struct sync_device *, const char *);
 double sync_get_val(const struct sync_track *, double);
 
+/*
+ * Evaluate every track of the device at row, once per frame, after
+ * sync_update(). sync_get_val() at that same row is then a plain load
+ * until the next frame, or until the track is edited. Tracks that cannot
+ * have changed since the previous frame are not evaluated again.
+ */
+void sync_begin_frame(struct sync_device *, double row);
+
+/*
+ * Evaluating tracks on other threads while the main thread edits them.
+ * Once per frame, after sync_update(), the main thread calls
+ * sync_publish() to snapshot the tracks edited since the last call.
+ * Each reading thread gets a reader from the main thread up front, and
+ * wraps its work in sync_read_begin() and sync_read_end(), mapping the
+ * tracks from sync_get_track() to their snapshots with sync_read_track().
+ * That returns NULL before the first sync_publish(), and its result is
+ * valid until sync_read_end(). Readers take no locks; a replaced
+ * snapshot is freed by a later sync_publish() once no reader might still
+ * see it. Readers must be destroyed before their device.
+ */
+struct sync_reader;
+struct sync_reader *sync_create_reader(struct sync_device *);
+void sync_destroy_reader(struct sync_reader *);
+int sync_publish(struct sync_device *);
+void sync_read_begin(struct sync_reader *);
+const struct sync_track *sync_read_track(const struct sync_track *);
+void sync_read_end(struct sync_reader *);
+
+/* Evaluate num_tracks tracks at the same row, storing the results in out */
+void sync_get_vals(const struct sync_track **, int, double, double *);
+void sync_get_valsf(const struct sync_track **, int, double, float *);
+
+/* Evaluate a track at count rows, starting at row_start, row_step apart */
+void sync_get_vals_range(const struct sync_track *, double, double, int,
+    double *);
+
+/*
+ * Group tracks that are evaluated together, e.g. the components of a
+ * vector. Each stays an ordinary track for the editor and on disk, but
+ * when they are keyed on the same rows, one search serves all of them.
+ * The group belongs to the device, asking for the same tracks again
+ * returns it again. Returns NULL when out of memory.
+ */
+const struct sync_group *sync_get_group(struct sync_device *,
+    const struct sync_track **, int);
+void sync_get_group_vals(const struct sync_group *, double, double *);
+void sync_get_group_valsf(const struct sync_group *, double, float *);
+
 #ifdef __cplusplus
 }
 #endif
@@ -0,0 +1,270 @@
+/* Copyright (C) 2010 Contributors
+ * For conditions of distribution and use, see copyright notice in COPYING
+ */
+
+#ifndef SYNC_HPP
+#define SYNC_HPP
+
+/*
+ * C++17 interface over sync.h. Evaluation is inlined through
+ * sync_inline.h, so this must be built with the same SYNC_PLAYER setting
+ * as the library. Errors are reported the way the C API reports them:
+ * a null handle, or a non-zero return value.
+ */
+
+#include <array>
+#include <cassert>
+#include <cstddef>
+#include <cstring>
+#include <string>
+#include <string_view>
+#include <type_traits>
+#include <utility>
+
+#include "sync_inline.h"
+
+namespace rocket {
+
+/* how a track is evaluated, see enum track_kind */
+enum class Kind {
+	Any = TRACK_UNCLASSIFIED,
+	Constant = TRACK_CONSTANT,
+	Step = TRACK_STEP,
+	Linear = TRACK_LINEAR,
+	Mixed = TRACK_MIXED
+};
+
+namespace detail {
+
+/* call f with a NUL-terminated copy of s, on the stack when short */
+template <typename F>
+auto with_cstr(std::string_view s, F &&f)
+{
+	char buf[128];
+	if (s.size() < sizeof(buf)) {
+		std::memcpy(buf, s.data(), s.size());
+		buf[s.size()] = '\0';
+		return f(buf);
+	}
+	return f(std::string(s).c_str());
+}
+
+} /* namespace detail */
+
+/*
+ * Non-owning handle to a track, valid for as long as its Device. Copying
+ * one is free.
+ */
+class Track {
+public:
+	Track() noexcept = default;
+	explicit Track(const sync_track *t) noexcept : t_(t) {}
+
+	explicit operator bool() const noexcept { return t_ != nullptr; }
+	const sync_track *get() const noexcept { return t_; }
+	std::string_view name() const noexcept { return t_->name; }
+	Kind kind() const noexcept { return static_cast<Kind>(t_->kind); }
+
+	/*
+	 * The value at row, bit-identical to sync_get_val() converted to T.
+	 * When K is the kind the track is known to have, e.g. for tracks of
+	 * a loaded demo, only that evaluator is compiled in; step and
+	 * constant tracks then return their float keys without a round trip
+	 * through double. A track of another kind takes the general path.
+	 */
+	template <typename T = double, Kind K = Kind::Any>
+	T get(double row) const
+	{
+		static_assert(std::is_floating_point_v<T>,
+		    "tracks evaluate to floating point");
+		if constexpr (K != Kind::Any) {
+			if (t_->kind == static_cast<enum track_kind>(K)
+#ifdef SYNC_PLAYER
+			    && !t_->baked
+#endif
+			    )
+				return get_kind<T, K>(row);
+		}
+		return static_cast<T>(sync_get_val_inline(t_, row));
+	}
+
+	double operator()(double row) const { return get(row); }
+
+private:
+	template <typename T, Kind K>
+	T get_kind(double row) const
+	{
+		if constexpr (K == Kind::Constant) {
+			return static_cast<T>(t_->num_keys ?
+			    t_->keys[0].value : 0.0f);
+		} else {
+			int idx = key_idx_floor(t_, static_cast<int>(floor(row)));
+			const track_seg *seg = t_->segs + idx + 1;
+			if constexpr (K == Kind::Step)
+				return static_cast<T>(t_->keys[idx < 0 ? 0 : idx].value);
+			else if constexpr (K == Kind::Linear)
+				return static_cast<T>(seg->a[0] +
+				    (row - seg->row) * seg->inv_len * seg->a[1]);
+			else
+				return static_cast<T>(sync_seg_eval(seg, row));
+		}
+	}
+
+	const sync_track *t_ = nullptr;
+};
+
+/* Owns a sync_device, which the Tracks looked up from it must not outlive */
+class Device {
+public:
+	explicit Device(std::string_view base)
+	    : d_(detail::with_cstr(base, sync_create_device)) {}
+	~Device() { if (d_) sync_destroy_device(d_); }
+
+	Device(Device &&other) noexcept : d_(std::exchange(other.d_, nullptr)) {}
+	Device &operator=(Device &&other) noexcept
+	{
+		std::swap(d_, other.d_);
+		return *this;
+	}
+	Device(const Device &) = delete;
+	Device &operator=(const Device &) = delete;
+
+	explicit operator bool() const noexcept { return d_ != nullptr; }
+	sync_device *get() const noexcept { return d_; }
+
+	/* look up or create a track, a null Track when out of memory */
+	Track track(std::string_view name)
+	{
+		return Track(detail::with_cstr(name, [this](const char *s) {
+			return sync_get_track(d_, s);
+		}));
+	}
+
+	/* see sync_begin_frame(), this only speeds up sync_get_val() */
+	void begin_frame(double row) { sync_begin_frame(d_, row); }
+	int publish() { return sync_publish(d_); }
+
+#ifndef SYNC_PLAYER
+	int tcp_connect(std::string_view host,
+	    unsigned short port = SYNC_DEFAULT_PORT)
+	{
+		return detail::with_cstr(host, [&](const char *s) {
+			return sync_tcp_connect(d_, s, port);
+		});
+	}
+	int tcp_connect_async(std::string_view host,
+	    unsigned short port = SYNC_DEFAULT_PORT)
+	{
+		return detail::with_cstr(host, [&](const char *s) {
+			return sync_tcp_connect_async(d_, s, port);
+		});
+	}
+	int update(int row, sync_cb &cb, void *data)
+	{
+		return sync_update(d_, row, &cb, data);
+	}
+	int set_net_thread(int max_cmds)
+	{
+		return sync_set_net_thread(d_, max_cmds);
+	}
+	int save_tracks() const { return sync_save_tracks(d_); }
+	int save_bundle() const { return sync_save_bundle(d_); }
+	int set_precision(std::string_view name, float step)
+	{
+		return detail::with_cstr(name, [&](const char *s) {
+			return sync_set_precision(d_, s, step);
+		});
+	}
+#else
+	void set_io_cb(sync_io_cb &cb) { sync_set_io_cb(d_, &cb); }
+	void set_bake_resolution(int rows_per_sample)
+	{
+		sync_set_bake_resolution(d_, rows_per_sample);
+	}
+	std::size_t baked_size() const { return sync_get_baked_size(d_); }
+	int load_tracks_from_memory(const void *buf, std::size_t len)
+	{
+		return sync_load_tracks_from_memory(d_, buf, len);
+	}
+#endif
+
+private:
+	sync_device *d_;
+};
+
+/*
+ * A thread's view of the snapshots published by Device::publish(), see
+ * sync_publish(). Create and destroy it on the main thread; tracks from
+ * track() are valid until end().
+ */
+class Reader {
+public:
+	explicit Reader(Device &d) : r_(sync_create_reader(d.get())) {}
+	~Reader() { if (r_) sync_destroy_reader(r_); }
+	Reader(const Reader &) = delete;
+	Reader &operator=(const Reader &) = delete;
+
+	explicit operator bool() const noexcept { return r_ != nullptr; }
+	void begin() { sync_read_begin(r_); }
+	void end() { sync_read_end(r_); }
+	Track track(Track live) const
+	{
+		return Track(sync_read_track(live.get()));
+	}
+
+private:
+	sync_reader *r_;
+};
+
+/*
+ * N tracks evaluated together at the same row as a sync_group, e.g. the
+ * components of a vector, searched once when keyed on the same rows:
+ *
+ *   rocket::TrackGroup<3> pos(device, {"cam.x", "cam.y", "cam.z"});
+ *   auto [x, y, z] = pos.get<float>(row);
+ */
+template <std::size_t N>
+class TrackGroup {
+public:
+	TrackGroup(Device &d, const std::array<std::string_view, N> &names)
+	{
+		std::array<const sync_track *, N> tracks;
+		for (std::size_t i = 0; i < N; ++i)
+			tracks[i] = d.track(names[i]).get();
+		g_ = sync_get_group(d.get(), tracks.data(), static_cast<int>(N));
+	}
+
+	/*
+	 * false if any of the tracks could not be created; get() and
+	 * operator[] assert that it is not
+	 */
+	explicit operator bool() const noexcept { return g_ != nullptr; }
+	const sync_group *get() const noexcept { return g_; }
+	static constexpr std::size_t size() noexcept { return N; }
+	Track operator[](std::size_t i) const
+	{
+		assert(g_ && "check the group before using it");
+		return Track(g_->tracks[i]);
+	}
+
+	template <typename T = double>
+	std::array<T, N> get(double row) const
+	{
+		static_assert(std::is_same_v<T, float> ||
+		    std::is_same_v<T, double>, "groups evaluate to float or double");
+		assert(g_ && "check the group before using it");
+		std::array<T, N> out;
+		if constexpr (std::is_same_v<T, float>)
+			sync_get_group_valsf(g_, row, out.data());
+		else
+			sync_get_group_vals(g_, row, out.data());
+		return out;
+	}
+
+private:
+	const sync_group *g_;
+};
+
+} /* namespace rocket */
+
+#endif /* !defined(SYNC_HPP) */
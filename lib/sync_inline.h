@@ -0,0 +1,87 @@
+/* Copyright (C) 2010 Contributors
+ * For conditions of distribution and use, see copyright notice in COPYING
+ */
+
+#ifndef SYNC_INLINE_H
+#define SYNC_INLINE_H
+
+/*
+ * Inline evaluation for hot loops, where the call into sync_get_val()
+ * dominates evaluating a classified track. This exposes the layout of
+ * struct sync_track, so it must be built with the same SYNC_PLAYER
+ * setting as the library, and tracks are only to be read through it:
+ * edits still go through the library. sync.h alone stays the stable API.
+ *
+ * sync_get_val_inline() returns exactly what sync_get_val() returns, and
+ * falls back to it only for tracks not yet classified since their last
+ * edit. key_idx_floor() from track.h is the matching search.
+ */
+
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+#include "base.h"
+#include "sync.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+#include "track.h"
+#ifdef __cplusplus
+}
+#endif
+
+static inline double sync_seg_eval(const struct track_seg *seg, double row)
+{
+	double x = (row - seg->row) * seg->inv_len;
+	return seg->a[0] + x * (seg->a[1] + x * (seg->a[2] + x * seg->a[3]));
+}
+
+#ifdef SYNC_PLAYER
+static inline double sync_baked_val(const struct sync_track *t, double row)
+{
+	double x = (row - t->bake_row) * t->bake_inv_step;
+	int i;
+
+	if (x <= 0.0)
+		return t->baked[0];
+	if (x >= t->num_baked - 1)
+		return t->baked[t->num_baked - 1];
+
+	i = (int)x;
+	return t->baked[i] + (t->baked[i + 1] - t->baked[i]) * (x - i);
+}
+#endif
+
+static inline double sync_get_val_inline(const struct sync_track *t,
+    double row)
+{
+	const struct track_seg *seg;
+	int idx;
+
+	switch (t->kind) {
+	case TRACK_CONSTANT:
+		/* If we have no keys at all, return a constant 0 */
+		return t->num_keys ? t->keys[0].value : 0.0;
+
+	default:
+		/* unclassified after edits, see sync_update() */
+		break;
+	}
+
+#ifdef SYNC_PLAYER
+	if (t->baked)
+		return sync_baked_val(t, row);
+#endif
+
+	idx = key_idx_floor(t, (int)floor(row));
+	seg = t->segs + idx + 1;
+	if (t->kind == TRACK_LINEAR)
+		/* sync_seg_eval() with a[2] and a[3] known to be zero */
+		return seg->a[0] + (row - seg->row) * seg->inv_len * seg->a[1];
+	if (t->kind == TRACK_STEP)
+		return t->keys[idx < 0 ? 0 : idx].value;
+	return sync_seg_eval(seg, row);
+}
+
+#endif /* !defined(SYNC_INLINE_H) */
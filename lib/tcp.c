@@ -6,6 +6,15 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
+
+#if !defined(WIN32) && !defined(USE_AMITCP) && !defined(GEKKO)
+ #include <errno.h>
+ #include <fcntl.h>
+ #define USE_NONBLOCKING_CONNECT
+#elif defined(WIN32)
+ #define USE_NONBLOCKING_CONNECT
+#endif
 
 struct sync_tcp {
 	SOCKET sock;
@@ -15,87 +24,127 @@ struct sync_tcp {
 static struct Library *socket_base = NULL;
 #endif
 
-static SOCKET server_connect(const char *host, unsigned short nport)
-{
-	SOCKET sock = INVALID_SOCKET;
+/* addresses host resolves to, looked up once for reconnecting */
+#define MAX_ADDRS 8
+
 #ifdef USE_GETADDRINFO
-	struct addrinfo *addr, *curr;
-	char port[6];
+typedef struct sockaddr_storage tcp_sockaddr;
 #else
-	struct hostent *he;
-	char **ap;
+typedef struct sockaddr_in tcp_sockaddr;
 #endif
 
+struct tcp_addr {
+	int family, len;
+	tcp_sockaddr sa;
+};
+
+static int net_init(void)
+{
 #ifdef WIN32
 	static int need_init = 1;
 	if (need_init) {
 		WSADATA wsa;
 		if (WSAStartup(MAKEWORD(2, 0), &wsa))
-			return INVALID_SOCKET;
+			return -1;
 		need_init = 0;
 	}
 #elif defined(USE_AMITCP)
 	if (!socket_base) {
 		socket_base = OpenLibrary("bsdsocket.library", 4);
 		if (!socket_base)
-			return INVALID_SOCKET;
+			return -1;
 	}
 #endif
+	return 0;
+}
+
+/* returns the number of addresses found */
+static int resolve(const char *host, unsigned short nport,
+    struct tcp_addr *addrs, int max_addrs)
+{
+	int num_addrs = 0;
+#ifdef USE_GETADDRINFO
+	struct addrinfo *addr, *curr;
+	char port[6];
+#else
+	struct hostent *he;
+	char **ap;
+#endif
+
+	if (net_init())
+		return 0;
 
 #ifdef USE_GETADDRINFO
 
 	snprintf(port, sizeof(port), "%u", nport);
 	if (getaddrinfo(host, port, 0, &addr) != 0)
-		return INVALID_SOCKET;
+		return 0;
 
-	for (curr = addr; curr; curr = curr->ai_next) {
-		int family = curr->ai_family;
-		struct sockaddr *sa = curr->ai_addr;
-		int sa_len = (int)curr->ai_addrlen;
+	for (curr = addr; curr && num_addrs < max_addrs; curr = curr->ai_next) {
+		struct tcp_addr *a = addrs + num_addrs;
+		if (curr->ai_addrlen > sizeof(a->sa))
+			continue;
+		a->family = curr->ai_family;
+		a->len = (int)curr->ai_addrlen;
+		memcpy(&a->sa, curr->ai_addr, curr->ai_addrlen);
+		num_addrs++;
+	}
+	freeaddrinfo(addr);
 
 #else
 
 	he = gethostbyname(host);
 	if (!he)
-		return INVALID_SOCKET;
+		return 0;
+
+	for (ap = he->h_addr_list; *ap && num_addrs < max_addrs; ++ap) {
+		struct tcp_addr *a = addrs + num_addrs++;
+		a->family = he->h_addrtype;
+		a->len = sizeof(a->sa);
+		a->sa.sin_family = he->h_addrtype;
+		a->sa.sin_port = htons(nport);
+		memcpy(&a->sa.sin_addr, *ap, he->h_length);
+		memset(&a->sa.sin_zero, 0, sizeof(a->sa.sin_zero));
+	}
 
-	for (ap = he->h_addr_list; *ap; ++ap) {
-		int family = he->h_addrtype;
-		struct sockaddr_in sin;
-		struct sockaddr *sa = (struct sockaddr *)&sin;
-		int sa_len = sizeof(*sa);
+#endif
+	return num_addrs;
+}
 
-		sin.sin_family = he->h_addrtype;
-		sin.sin_port = htons(nport);
-		memcpy(&sin.sin_addr, *ap, he->h_length);
-		memset(&sin.sin_zero, 0, sizeof(sin.sin_zero));
+static void set_nodelay(SOCKET sock)
+{
+#ifdef USE_NODELAY
+	int yes = 1;
 
+	/* Try disabling Nagle since we're latency-sensitive, UDP would
+	 * really be more appropriate but that's a much bigger change.
+	 */
+	(void) setsockopt(sock, IPPROTO_TCP, TCP_NODELAY, (void *)&yes, sizeof(yes));
+#else
+	(void)sock;
 #endif
-		sock = socket(family, SOCK_STREAM, 0);
+}
+
+static SOCKET server_connect(const char *host, unsigned short nport)
+{
+	struct tcp_addr addrs[MAX_ADDRS];
+	int i, num_addrs = resolve(host, nport, addrs, MAX_ADDRS);
+
+	for (i = 0; i < num_addrs; ++i) {
+		SOCKET sock = socket(addrs[i].family, SOCK_STREAM, 0);
 		if (sock == INVALID_SOCKET)
 			continue;
 
-		if (connect(sock, sa, sa_len) >= 0) {
-#ifdef USE_NODELAY
-			int yes = 1;
-
-			/* Try disabling Nagle since we're latency-sensitive, UDP would
-			 * really be more appropriate but that's a much bigger change.
-			 */
-			(void) setsockopt(sock, IPPROTO_TCP, TCP_NODELAY, (void *)&yes, sizeof(yes));
-#endif
-			break;
+		if (connect(sock, (struct sockaddr *)&addrs[i].sa,
+		    addrs[i].len) >= 0) {
+			set_nodelay(sock);
+			return sock;
 		}
 
 		closesocket(sock);
-		sock = INVALID_SOCKET;
 	}
 
-#ifdef USE_GETADDRINFO
-	freeaddrinfo(addr);
-#endif
-
-	return sock;
+	return INVALID_SOCKET;
 }
 
 static int sync_tcp_poll(void *ctxt, int *res_readable, int *res_writeable)
@@ -146,6 +195,34 @@ static int sync_tcp_poll(void *ctxt, int *res_readable, int *res_writeable)
 #endif
 }
 
+static int sync_tcp_wait(void *ctxt, int timeout_ms)
+{
+	struct sync_tcp *tcp = ctxt;
+#ifdef GEKKO
+	struct pollsd sds[1];
+	sds[0].socket  = tcp->sock;
+	sds[0].events  = POLLIN;
+	sds[0].revents = 0;
+	return net_poll(sds, 1, timeout_ms);
+#else
+	struct timeval to;
+	fd_set rfds;
+
+	to.tv_sec = timeout_ms / 1000;
+	to.tv_usec = timeout_ms % 1000 * 1000;
+	FD_ZERO(&rfds);
+#ifdef _MSC_VER
+#pragma warning(push)
+#pragma warning(disable: 4127)
+#endif
+	FD_SET(tcp->sock, &rfds);
+#ifdef _MSC_VER
+#pragma warning(pop)
+#endif
+	return select((int)tcp->sock + 1, &rfds, NULL, NULL, &to);
+#endif
+}
+
 static int sync_tcp_send(void *ctxt, const void *buf, int len)
 {
 	struct sync_tcp *tcp = ctxt;
@@ -153,6 +230,9 @@ static int sync_tcp_send(void *ctxt, const void *buf, int len)
 #ifdef WIN32
 	assert(len <= INT_MAX);
 	return send(tcp->sock, (const char *)buf, (int)len, 0);
+#elif defined(MSG_DONTWAIT)
+	/* take what fits rather than block, see flush_send() */
+	return send(tcp->sock, (const char *)buf, len, MSG_DONTWAIT);
 #else
 	return send(tcp->sock, (const char *)buf, len, 0);
 #endif
@@ -199,7 +279,230 @@ int sync_tcp_connect(struct sync_device *d, const char *host, unsigned short por
 		return -1;
 	}
 
-	return sync_set_sockio_cb(d, &sync_tcp_sockio, tcp);
+	if (sync_set_sockio_cb(d, &sync_tcp_sockio, tcp))
+		return -1;
+	sync_set_sockio_wait(d, sync_tcp_wait);
+	return 0;
+}
+
+/*
+ * Reconnecting never waits on the network: the socket is connected
+ * without blocking, and sync_update() checks on it once per call. Where
+ * that is not supported, connect() blocks, but at most once per delay.
+ */
+#define MIN_RETRY_DELAY 250 /* ms, doubled after each failed attempt */
+#define MAX_RETRY_DELAY 4000
+#define CONNECT_TIMEOUT 2000 /* for connecting, and again for the greeting */
+
+struct tcp_reconnect {
+	struct tcp_addr addrs[MAX_ADDRS];
+	int num_addrs, next_addr;
+	SOCKET sock; /* being connected, or INVALID_SOCKET */
+	unsigned long retry_time, deadline; /* see now_ms() */
+	unsigned long delay;
+};
+
+static unsigned long now_ms(void)
+{
+#ifdef WIN32
+	return GetTickCount();
+#elif defined(USE_NONBLOCKING_CONNECT)
+	struct timeval tv;
+	gettimeofday(&tv, NULL);
+	return (unsigned long)tv.tv_sec * 1000 + tv.tv_usec / 1000;
+#else
+	return (unsigned long)time(NULL) * 1000;
+#endif
+}
+
+/* whether time a has come, allowing for wrap-around */
+static int reached(unsigned long now, unsigned long a)
+{
+	return now - a < ~0UL / 2;
+}
+
+static SOCKET start_connect(const struct tcp_addr *a)
+{
+	SOCKET sock = socket(a->family, SOCK_STREAM, 0);
+	int ret;
+#ifdef WIN32
+	u_long yes = 1;
+#endif
+
+	if (sock == INVALID_SOCKET)
+		return sock;
+
+#ifdef WIN32
+	if (!ioctlsocket(sock, FIONBIO, &yes)) {
+		ret = connect(sock, (struct sockaddr *)&a->sa, a->len);
+		if (ret >= 0 || WSAGetLastError() == WSAEWOULDBLOCK)
+			return sock;
+	}
+#elif defined(USE_NONBLOCKING_CONNECT)
+	ret = fcntl(sock, F_GETFL, 0);
+	if (ret >= 0 && fcntl(sock, F_SETFL, ret | O_NONBLOCK) >= 0) {
+		ret = connect(sock, (struct sockaddr *)&a->sa, a->len);
+		if (ret >= 0 || errno == EINPROGRESS)
+			return sock;
+	}
+#else
+	ret = connect(sock, (struct sockaddr *)&a->sa, a->len);
+	if (ret >= 0)
+		return sock;
+#endif
+
+	closesocket(sock);
+	return INVALID_SOCKET;
+}
+
+/* returns 1 once connected, 0 while connecting and -1 on failure */
+static int poll_connect(SOCKET sock)
+{
+#ifdef USE_NONBLOCKING_CONNECT
+	struct timeval to = { 0, 0 };
+	fd_set wfds, efds;
+	int err = 0;
+	socklen_t len = sizeof(err);
+#ifdef WIN32
+	u_long no = 0;
+#endif
+
+	FD_ZERO(&wfds);
+	FD_ZERO(&efds);
+#ifdef _MSC_VER
+#pragma warning(push)
+#pragma warning(disable: 4127)
+#endif
+	FD_SET(sock, &wfds);
+	FD_SET(sock, &efds);
+#ifdef _MSC_VER
+#pragma warning(pop)
+#endif
+
+	/* failures show in efds on Windows, and as SO_ERROR elsewhere */
+	if (select((int)sock + 1, NULL, &wfds, &efds, &to) < 0)
+		return -1;
+	if (FD_ISSET(sock, &efds))
+		return -1;
+	if (!FD_ISSET(sock, &wfds))
+		return 0;
+	if (getsockopt(sock, SOL_SOCKET, SO_ERROR, (char *)&err, &len) ||
+	    err)
+		return -1;
+
+	/* the sockio callbacks expect a blocking socket */
+#ifdef WIN32
+	if (ioctlsocket(sock, FIONBIO, &no))
+		return -1;
+#else
+	err = fcntl(sock, F_GETFL, 0);
+	if (err < 0 || fcntl(sock, F_SETFL, err & ~O_NONBLOCK) < 0)
+		return -1;
+#endif
+#else
+	(void)sock;
+#endif
+	return 1;
+}
+
+void sync_tcp_free_reconnect(struct tcp_reconnect *r)
+{
+	if (!r)
+		return;
+	if (r->sock != INVALID_SOCKET)
+		closesocket(r->sock);
+	free(r);
+}
+
+int sync_tcp_connect_async(struct sync_device *d, const char *host,
+    unsigned short port)
+{
+	struct tcp_reconnect *r = malloc(sizeof(*r));
+	if (!r)
+		return -1;
+
+	r->num_addrs = resolve(host, port, r->addrs, MAX_ADDRS);
+	if (!r->num_addrs) {
+		free(r);
+		return -1;
+	}
+	r->next_addr = 0;
+	r->sock = INVALID_SOCKET;
+	r->retry_time = now_ms();
+	r->delay = MIN_RETRY_DELAY;
+
+	sync_tcp_free_reconnect(d->reconnect);
+	d->reconnect = r;
+	return 0;
+}
+
+/*
+ * One step towards a connection, called by sync_update() while the
+ * device is not connected. Returns 0 once it is.
+ */
+int sync_tcp_reconnect(struct sync_device *d)
+{
+	struct tcp_reconnect *r = d->reconnect;
+	unsigned long now = now_ms();
+	struct sync_tcp *tcp;
+	int ret;
+
+	if (d->sockio_ctxt) {
+		ret = sync_poll_greet(d);
+		if (ret > 0) {
+			r->delay = MIN_RETRY_DELAY;
+			return 0;
+		}
+		if (!ret && !reached(now, r->deadline))
+			return -1;
+		sync_drop_connection(d);
+		goto retry;
+	}
+
+	if (r->sock == INVALID_SOCKET) {
+		if (!reached(now, r->retry_time))
+			return -1;
+		r->sock = start_connect(r->addrs + r->next_addr);
+		r->deadline = now + CONNECT_TIMEOUT;
+		if (r->sock == INVALID_SOCKET)
+			goto next_addr;
+	}
+
+	ret = poll_connect(r->sock);
+	if (!ret && !reached(now, r->deadline))
+		return -1;
+	if (ret <= 0) {
+		closesocket(r->sock);
+		r->sock = INVALID_SOCKET;
+		goto next_addr;
+	}
+
+	set_nodelay(r->sock);
+	tcp = malloc(sizeof(*tcp));
+	if (!tcp) {
+		closesocket(r->sock);
+		r->sock = INVALID_SOCKET;
+		goto retry;
+	}
+	tcp->sock = r->sock;
+	r->sock = INVALID_SOCKET;
+	r->next_addr = 0;
+	if (sync_begin_greet(d, &sync_tcp_sockio, tcp))
+		goto retry;
+	sync_set_sockio_wait(d, sync_tcp_wait);
+	r->deadline = now + CONNECT_TIMEOUT;
+	return -1;
+
+next_addr:
+	/* the next address is tried on the next call */
+	if (++r->next_addr < r->num_addrs)
+		return -1;
+retry:
+	r->next_addr = 0;
+	r->retry_time = now + r->delay;
+	if (r->delay < MAX_RETRY_DELAY)
+		r->delay *= 2;
+	return -1;
 }
 
 int sync_connect(struct sync_device *d, const char *host, unsigned short port)
@@ -3,60 +3,595 @@
 #include <math.h>
 
 #include "sync.h"
+#include "sync_inline.h"
 #include "track.h"
 #include "base.h"
 
-static double key_linear(const struct track_key k[2], double row)
+#if !defined(SYNC_NO_SIMD) && (defined(__SSE2__) || defined(_M_X64) || \
+    (defined(_M_IX86_FP) && _M_IX86_FP >= 2))
+ #define USE_SSE2
+ #include <emmintrin.h>
+ #if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+  /* selected at runtime, see select_interp() */
+  #define USE_AVX
+  #include <immintrin.h>
+ #endif
+#endif
+
+static void *track_alloc(struct sync_track *t, size_t size)
 {
-	double t = (row - k[0].row) / (k[1].row - k[0].row);
-	return k[0].value + (k[1].value - k[0].value) * t;
+#ifdef SYNC_PLAYER
+	return sync_arena_alloc(t->arena, size);
+#else
+	return malloc(size);
+#endif
+}
+
+static void track_free(void *ptr)
+{
+#ifndef SYNC_PLAYER
+	free(ptr); /* player builds release the whole arena at once */
+#endif
+}
+
+/*
+ * Like SyncTrack::getPolynomial() in the editor, every interpolation type
+ * is a cubic in the normalized position within the segment. We store the
+ * cubic with the value-delta folded in, so evaluation is a single Horner
+ * step. Before the first and after the last key, the segment is constant.
+ */
+static void set_seg(struct sync_track *t, int s)
+{
+	struct track_seg *seg = t->segs + s;
+	const struct track_key *k;
+	float mag;
+
+	if (s == 0 || s == t->num_keys || t->keys[s - 1].type == KEY_STEP) {
+		seg->row = 0.0;
+		seg->inv_len = 0.0;
+		seg->a[0] = t->keys[s ? s - 1 : 0].value;
+		seg->a[1] = seg->a[2] = seg->a[3] = 0.0;
+		return;
+	}
+
+	k = t->keys + s - 1;
+	mag = k[1].value - k[0].value;
+	seg->row = k[0].row;
+	seg->inv_len = 1.0 / ((double)k[1].row - k[0].row);
+	seg->a[0] = k[0].value;
+	switch (k->type) {
+	case KEY_LINEAR:
+		seg->a[1] = mag;
+		seg->a[2] = seg->a[3] = 0.0;
+		break;
+
+	case KEY_SMOOTH:
+		seg->a[1] = 0.0;
+		seg->a[2] = 3.0 * mag;
+		seg->a[3] = -2.0 * mag;
+		break;
+
+	case KEY_RAMP:
+		seg->a[1] = seg->a[3] = 0.0;
+		seg->a[2] = mag;
+		break;
+
+	default:
+		assert(0);
+		seg->a[1] = seg->a[2] = seg->a[3] = 0.0;
+	}
 }
 
-static double key_smooth(const struct track_key k[2], double row)
+/*
+ * A segment between two equal values evaluates to that value whatever its
+ * type, as does a STEP segment, since the Horner step only adds zeros.
+ * The exception is -0.0, where the sign of the result would depend on the
+ * row, so such tracks are left to the general evaluator.
+ */
+void sync_classify_track(struct sync_track *t)
 {
-	double t = (row - k[0].row) / (k[1].row - k[0].row);
-	t = t * t * (3 - 2 * t);
-	return k[0].value + (k[1].value - k[0].value) * t;
+	int i, constant = 1, steps = 1, linear = 1;
+
+	for (i = 0; i < t->num_keys; ++i) {
+		const struct track_key *k = t->keys + i;
+		if (k->value == 0.0f && 1.0f / k->value < 0.0f) {
+			t->kind = TRACK_MIXED;
+			return;
+		}
+		if (k->value != t->keys[0].value)
+			constant = 0;
+		if (i + 1 == t->num_keys || k->type == KEY_STEP ||
+		    k->value == k[1].value)
+			continue;
+		steps = 0;
+		if (k->type != KEY_LINEAR)
+			linear = 0;
+	}
+
+	t->kind = constant ? TRACK_CONSTANT : steps ? TRACK_STEP :
+	    linear ? TRACK_LINEAR : TRACK_MIXED;
 }
 
-static double key_ramp(const struct track_key k[2], double row)
+/* recompute segments first..last, clamped to the valid range */
+static void update_segs(struct sync_track *t, int first, int last)
 {
-	double t = (row - k[0].row) / (k[1].row - k[0].row);
-	t = pow(t, 2.0);
-	return k[0].value + (k[1].value - k[0].value) * t;
+	int s;
+	if (first < 0)
+		first = 0;
+	if (last > t->num_keys)
+		last = t->num_keys;
+	for (s = first; s <= last; ++s)
+		set_seg(t, s);
+	t->kind = TRACK_UNCLASSIFIED;
+	t->serial++;
+}
+
+int sync_build_segs(struct sync_track *t)
+{
+	track_free(t->segs);
+	t->segs = NULL;
+	t->kind = TRACK_CONSTANT;
+	t->serial++;
+	if (!t->num_keys)
+		return 0;
+
+	assert(t->capacity >= t->num_keys);
+	t->segs = track_alloc(t, sizeof(struct track_seg) * (t->capacity + 1));
+	if (!t->segs)
+		return -1;
+
+	update_segs(t, 0, t->num_keys);
+	sync_classify_track(t);
+	return 0;
+}
+
+int sync_build_index(struct sync_track *t)
+{
+	struct track_index *ix;
+	int i;
+
+	track_free(t->index);
+	t->index = NULL;
+	if (t->num_keys < INDEX_MIN_KEYS)
+		return 0;
+
+	ix = track_alloc(t, sizeof(*ix) + sizeof(int) * t->num_keys);
+	if (!ix)
+		return -1;
+
+	ix->size = t->num_keys;
+	ix->rows = (int *)(ix + 1);
+	for (i = 0; i < t->num_keys; ++i)
+		ix->rows[i] = t->keys[i].row;
+
+	t->index = ix;
+	return 0;
+}
+
+#ifdef SYNC_PLAYER
+/*
+ * Sample the track every step rows from its first key until past its
+ * last one, so evaluation becomes an index and a lerp between samples.
+ * This is exact at the samples, and for linear segments spanning whole
+ * samples; elsewhere the error is bounded by how much the exact value
+ * varies between two neighbouring samples. Keys too far apart to sample
+ * within MAX_BAKED leave the track unbaked, evaluated as it is.
+ */
+int sync_bake_track(struct sync_track *t, int step)
+{
+	int i, first, last;
+	double span;
+
+	assert(step > 0);
+	track_free(t->baked);
+	t->baked = NULL;
+	t->num_baked = 0;
+	if (!t->num_keys)
+		return 0;
+
+	first = t->keys[0].row;
+	last = t->keys[t->num_keys - 1].row;
+	span = floor(((double)last - first + step - 1) / step);
+	if (span >= MAX_BAKED)
+		return 0;
+	t->num_baked = (int)span + 1;
+	t->baked = track_alloc(t, sizeof(float) * t->num_baked);
+	if (!t->baked) {
+		t->num_baked = 0;
+		return -1;
+	}
+
+	for (i = 0; i < t->num_baked; ++i) {
+		/* the value holds past the last key, where rows may overflow */
+		double x = first + (double)i * step;
+		int row = x < last ? (int)x : last;
+		t->baked[i] = (float)sync_seg_eval(
+		    t->segs + key_idx_floor(t, row) + 1, row);
+	}
+	t->bake_row = first;
+	t->bake_inv_step = 1.0 / step;
+	return 0;
+}
+#endif
+
+/* pull in the track a few iterations ahead, and the segment of the next one */
+static inline void prefetch_tracks(const struct sync_track **tracks,
+    int i, int num_tracks)
+{
+	if (i + 4 < num_tracks)
+		sync_prefetch(tracks[i + 4]);
+	if (i + 2 < num_tracks && tracks[i + 2]->segs)
+		sync_prefetch(tracks[i + 2]->segs +
+		    atomic_load_relaxed(&tracks[i + 2]->cursor) + 1);
 }
 
 double sync_get_val(const struct sync_track *t, double row)
 {
-	int idx, irow;
+	if (row == t->frame_row && t->frame_serial == t->serial)
+		return t->frame_val;
+	return sync_get_val_inline(t, row);
+}
+
+/* whether the value cached for the last frame may differ at row */
+static int frame_val_stale(const struct sync_track *t, double row)
+{
+	if (t->frame_serial != t->serial)
+		return 1;
+	if (row == t->frame_row || t->kind == TRACK_CONSTANT)
+		return 0;
+#ifdef SYNC_PLAYER
+	if (t->baked)
+		return 1;
+#endif
+	/* piecewise constant, so the value holds within a segment */
+	return t->kind != TRACK_STEP ||
+	    !key_idx_in_segment(t, t->frame_seg, (int)floor(row));
+}
+
+/*
+ * Remember the value at row for sync_get_val(). Edits bump the serial, so
+ * a track is only evaluated again when edited since the last frame, or
+ * when its value may have moved.
+ */
+void sync_cache_val(struct sync_track *t, double row)
+{
+	if (frame_val_stale(t, row)) {
+		t->frame_val = sync_get_val_inline(t, row);
+		t->frame_seg = t->cursor;
+		t->frame_serial = t->serial;
+	}
+	t->frame_row = row;
+}
+
+void sync_get_vals_range(const struct sync_track *t, double row_start,
+    double row_step, int count, double *out)
+{
+	int i, idx;
+
+	if (!t->num_keys) {
+		for (i = 0; i < count; ++i)
+			out[i] = 0.0;
+		return;
+	}
+
+#ifdef SYNC_PLAYER
+	if (t->baked) {
+		for (i = 0; i < count; ++i)
+			out[i] = sync_baked_val(t, row_start + row_step * i);
+		return;
+	}
+#endif
+
+	/* search once, then walk the keys along with the samples */
+	idx = key_idx_floor(t, (int)floor(row_start));
+	for (i = 0; i < count; ++i) {
+		double row = row_start + row_step * i;
+		int irow = (int)floor(row);
+		while (idx + 1 < t->num_keys && t->keys[idx + 1].row <= irow)
+			idx++;
+		while (idx >= 0 && t->keys[idx].row > irow)
+			idx--;
+		out[i] = sync_seg_eval(t->segs + idx + 1, row);
+	}
+	atomic_store_relaxed(&((struct sync_track *)t)->cursor, idx);
+}
+
+/*
+ * The batch API evaluates tracks in groups of BATCH_LANES: the segments
+ * are looked up one track at a time, and evaluated in place by the
+ * scalar kernel. With sync_set_simd(), full batches are instead gathered
+ * into a seg_batch so the Horner step runs as a SIMD kernel over all
+ * lanes; gathering costs about what that saves, so it is off by default.
+ */
+#define BATCH_LANES 8
 
-	/* If we have no keys at all, return a constant 0 */
+static double eval_lane(const struct sync_track *t, double row, int irow)
+{
 	if (!t->num_keys)
-		return 0.0f;
+		return 0.0;
+#ifdef SYNC_PLAYER
+	if (t->baked)
+		return sync_baked_val(t, row);
+#endif
+	return sync_seg_eval(t->segs + key_idx_floor(t, irow) + 1, row);
+}
 
-	irow = (int)floor(row);
-	idx = key_idx_floor(t, irow);
+static void eval_scalar(const struct sync_track **tracks, int num_tracks,
+    double row, int irow, double *out)
+{
+	int i;
+	for (i = 0; i < num_tracks; ++i) {
+		prefetch_tracks(tracks, i, num_tracks);
+		out[i] = eval_lane(tracks[i], row, irow);
+	}
+}
 
-	/* at the edges, return the first/last value */
-	if (idx < 0)
-		return t->keys[0].value;
-	if (idx > (int)t->num_keys - 2)
-		return t->keys[t->num_keys - 1].value;
+#ifdef USE_SSE2
 
-	/* interpolate according to key-type */
-	switch (t->keys[idx].type) {
-	case KEY_STEP:
-		return t->keys[idx].value;
-	case KEY_LINEAR:
-		return key_linear(t->keys + idx, row);
-	case KEY_SMOOTH:
-		return key_smooth(t->keys + idx, row);
-	case KEY_RAMP:
-		return key_ramp(t->keys + idx, row);
-	default:
-		assert(0);
-		return 0.0f;
+struct seg_batch {
+	double row[BATCH_LANES];
+	double inv_len[BATCH_LANES];
+	double a[4][BATCH_LANES];
+};
+
+static void gather_segs(struct seg_batch *b, const struct sync_track **tracks,
+    int num_tracks, double row, int irow)
+{
+	int i, j;
+	for (i = 0; i < BATCH_LANES; ++i) {
+		const struct sync_track *t;
+		const struct track_seg *seg;
+
+		prefetch_tracks(tracks, i, num_tracks);
+		t = tracks[i];
+
+		/* empty and baked tracks end up as a constant lane */
+		b->row[i] = b->inv_len[i] = 0.0;
+		for (j = 1; j < 4; ++j)
+			b->a[j][i] = 0.0;
+		if (!t->num_keys
+#ifdef SYNC_PLAYER
+		    || t->baked
+#endif
+		    ) {
+			b->a[0][i] = eval_lane(t, row, irow);
+			continue;
+		}
+
+		seg = t->segs + key_idx_floor(t, irow) + 1;
+		b->row[i] = seg->row;
+		b->inv_len[i] = seg->inv_len;
+		for (j = 0; j < 4; ++j)
+			b->a[j][i] = seg->a[j];
+	}
+}
+
+static void interp_sse2(const struct seg_batch *b, double row, double *out)
+{
+	const __m128d r = _mm_set1_pd(row);
+	int i;
+
+	for (i = 0; i < BATCH_LANES; i += 2) {
+		__m128d x = _mm_mul_pd(_mm_sub_pd(r, _mm_loadu_pd(b->row + i)),
+		    _mm_loadu_pd(b->inv_len + i));
+		__m128d v = _mm_loadu_pd(b->a[3] + i);
+		v = _mm_add_pd(_mm_loadu_pd(b->a[2] + i), _mm_mul_pd(x, v));
+		v = _mm_add_pd(_mm_loadu_pd(b->a[1] + i), _mm_mul_pd(x, v));
+		v = _mm_add_pd(_mm_loadu_pd(b->a[0] + i), _mm_mul_pd(x, v));
+		_mm_storeu_pd(out + i, v);
+	}
+}
+
+#ifdef USE_AVX
+__attribute__((target("avx")))
+static void interp_avx(const struct seg_batch *b, double row, double *out)
+{
+	const __m256d r = _mm256_set1_pd(row);
+	int i;
+
+	for (i = 0; i < BATCH_LANES; i += 4) {
+		__m256d x = _mm256_mul_pd(_mm256_sub_pd(r,
+		    _mm256_loadu_pd(b->row + i)), _mm256_loadu_pd(b->inv_len + i));
+		__m256d v = _mm256_loadu_pd(b->a[3] + i);
+		v = _mm256_add_pd(_mm256_loadu_pd(b->a[2] + i), _mm256_mul_pd(x, v));
+		v = _mm256_add_pd(_mm256_loadu_pd(b->a[1] + i), _mm256_mul_pd(x, v));
+		v = _mm256_add_pd(_mm256_loadu_pd(b->a[0] + i), _mm256_mul_pd(x, v));
+		_mm256_storeu_pd(out + i, v);
+	}
+}
+#endif
+
+typedef void (*interp_fn)(const struct seg_batch *, double, double *);
+
+static interp_fn interp; /* NULL for the scalar kernel */
+
+static interp_fn select_interp(void)
+{
+#ifdef USE_AVX
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("avx"))
+		return interp_avx;
+#endif
+	return interp_sse2;
+}
+
+#endif /* defined(USE_SSE2) */
+
+void sync_set_simd(int enable)
+{
+#ifdef USE_SSE2
+	interp = enable ? select_interp() : NULL;
+#else
+	(void)enable;
+#endif
+}
+
+/* evaluate up to BATCH_LANES tracks */
+static void eval_batch(const struct sync_track **tracks, int num_tracks,
+    double row, int irow, double *out)
+{
+#ifdef USE_SSE2
+	if (num_tracks >= BATCH_LANES && interp) {
+		struct seg_batch b;
+		gather_segs(&b, tracks, num_tracks, row, irow);
+		interp(&b, row, out);
+		return;
 	}
+#endif
+	eval_scalar(tracks, num_tracks < BATCH_LANES ? num_tracks :
+	    BATCH_LANES, row, irow, out);
+}
+
+void sync_get_vals(const struct sync_track **tracks, int num_tracks,
+    double row, double *out)
+{
+	int i, irow = (int)floor(row);
+	for (i = 0; i < num_tracks; i += BATCH_LANES)
+		eval_batch(tracks + i, num_tracks - i, row, irow, out + i);
+}
+
+void sync_get_valsf(const struct sync_track **tracks, int num_tracks,
+    double row, float *out)
+{
+	double tmp[BATCH_LANES];
+	int i, j, irow = (int)floor(row);
+
+	for (i = 0; i < num_tracks; i += BATCH_LANES) {
+		eval_batch(tracks + i, num_tracks - i, row, irow, tmp);
+		for (j = 0; j < BATCH_LANES && i + j < num_tracks; ++j)
+			out[i + j] = (float)tmp[j];
+	}
+}
+
+/*
+ * A copy of t for other threads to read while t is edited, see
+ * sync_publish(). It is classified up front, as readers must not write
+ * anything but the cursor. Player tracks are never edited, so only the
+ * struct is copied there.
+ */
+struct sync_track *sync_snapshot_track(const struct sync_track *t)
+{
+	struct sync_track *s = malloc(sizeof(*s));
+	if (!s)
+		return NULL;
+
+	*s = *t;
+	s->snapshot = NULL;
+	s->cursor = -1;
+	s->frame_serial = s->serial - 1;
+#ifndef SYNC_PLAYER
+	s->keys = NULL;
+	s->segs = NULL;
+	s->index = NULL;
+	s->capacity = s->num_keys;
+	if (s->num_keys) {
+		s->keys = malloc(sizeof(struct track_key) * s->num_keys);
+		s->segs = malloc(sizeof(struct track_seg) * (s->num_keys + 1));
+		if (!s->keys || !s->segs) {
+			sync_free_snapshot(s);
+			return NULL;
+		}
+		memcpy(s->keys, t->keys, sizeof(struct track_key) * s->num_keys);
+		memcpy(s->segs, t->segs,
+		    sizeof(struct track_seg) * (s->num_keys + 1));
+		if (sync_build_index(s)) {
+			sync_free_snapshot(s);
+			return NULL;
+		}
+	}
+#endif
+	if (s->kind == TRACK_UNCLASSIFIED)
+		sync_classify_track(s);
+	return s;
+}
+
+void sync_free_snapshot(struct sync_track *s)
+{
+#ifndef SYNC_PLAYER
+	free(s->keys);
+	free(s->segs);
+	free(s->index);
+#endif
+	free(s);
+}
+
+int sync_build_group(struct sync_group *g)
+{
+	const struct sync_track *first = g->tracks[0];
+	int i, j, n = g->num_tracks;
+
+	free(g->segs);
+	g->segs = NULL;
+	for (j = 0; j < n; ++j)
+		g->serials[j] = g->tracks[j]->serial;
+
+	/* only worth interleaving when the components share their rows */
+	for (j = 0; j < n; ++j) {
+		const struct sync_track *t = g->tracks[j];
+		if (!t->num_keys || t->num_keys != first->num_keys)
+			return 0;
+#ifdef SYNC_PLAYER
+		if (t->baked)
+			return 0;
+#endif
+		for (i = 0; i < t->num_keys; ++i)
+			if (t->keys[i].row != first->keys[i].row)
+				return 0;
+	}
+
+	g->segs = malloc(sizeof(struct track_seg) * n * (first->num_keys + 1));
+	if (!g->segs)
+		return -1;
+	for (i = 0; i <= first->num_keys; ++i)
+		for (j = 0; j < n; ++j)
+			g->segs[i * n + j] = g->tracks[j]->segs[i];
+	return 0;
+}
+
+/* the interleaved segments of the row, or NULL to evaluate one by one */
+static const struct track_seg *group_segs(const struct sync_group *g,
+    double row)
+{
+	int j;
+
+	for (j = 0; j < g->num_tracks; ++j)
+		if (g->serials[j] != g->tracks[j]->serial) {
+			if (sync_build_group((struct sync_group *)g))
+				return NULL;
+			break;
+		}
+	if (!g->segs)
+		return NULL;
+	return g->segs + (key_idx_floor(g->tracks[0], (int)floor(row)) + 1) *
+	    g->num_tracks;
+}
+
+void sync_get_group_vals(const struct sync_group *g, double row,
+    double *out)
+{
+	const struct track_seg *seg = group_segs(g, row);
+	int j;
+
+	if (!seg) {
+		sync_get_vals(g->tracks, g->num_tracks, row, out);
+		return;
+	}
+	for (j = 0; j < g->num_tracks; ++j)
+		out[j] = sync_seg_eval(seg + j, row);
+}
+
+void sync_get_group_valsf(const struct sync_group *g, double row,
+    float *out)
+{
+	const struct track_seg *seg = group_segs(g, row);
+	int j;
+
+	if (!seg) {
+		sync_get_valsf(g->tracks, g->num_tracks, row, out);
+		return;
+	}
+	for (j = 0; j < g->num_tracks; ++j)
+		out[j] = (float)sync_seg_eval(seg + j, row);
 }
 
 int sync_find_key(const struct sync_track *t, int row)
@@ -82,40 +617,142 @@ int sync_find_key(const struct sync_track *t, int row)
 }
 
 #ifndef SYNC_PLAYER
+static void drop_index(struct sync_track *t)
+{
+	/* rebuilt by sync_update() once all pending edits are applied */
+	free(t->index);
+	t->index = NULL;
+}
+
+#define MIN_CAPACITY 8
+
+static int resize_keys(struct sync_track *t, int capacity)
+{
+	void *tmp = realloc(t->keys, sizeof(struct track_key) * capacity);
+	if (!tmp)
+		return -1;
+	t->keys = tmp;
+	tmp = realloc(t->segs, sizeof(struct track_seg) * (capacity + 1));
+	if (!tmp)
+		return -1;
+	t->segs = tmp;
+	t->capacity = capacity;
+	return 0;
+}
+
+/*
+ * Grow geometrically, so streaming in a track key by key only costs
+ * O(log n) reallocations, and shrink only once we're down to a quarter,
+ * so alternating inserts and deletes can't make us thrash.
+ */
+static int reserve_keys(struct sync_track *t, int num_keys)
+{
+	int capacity = t->capacity > MIN_CAPACITY ? t->capacity : MIN_CAPACITY;
+	if (num_keys <= t->capacity)
+		return 0;
+	while (capacity < num_keys)
+		capacity *= 2;
+	return resize_keys(t, capacity);
+}
+
+static void trim_keys(struct sync_track *t)
+{
+	if (t->capacity > MIN_CAPACITY && t->num_keys < t->capacity / 4)
+		resize_keys(t, t->capacity / 2); /* keep the old on failure */
+}
+
 int sync_set_key(struct sync_track *t, const struct track_key *k)
 {
 	int idx = sync_find_key(t, k->row);
 	if (idx < 0) {
 		/* no exact hit, we need to allocate a new key */
-		void *tmp;
 		idx = -idx - 1;
-		tmp = realloc(t->keys, sizeof(struct track_key) *
-		    (t->num_keys + 1));
-		if (!tmp)
+		if (reserve_keys(t, t->num_keys + 1))
 			return -1;
+		drop_index(t);
 		t->num_keys++;
-		t->keys = tmp;
 		memmove(t->keys + idx + 1, t->keys + idx,
 		    sizeof(struct track_key) * (t->num_keys - idx - 1));
+		memmove(t->segs + idx + 2, t->segs + idx + 1,
+		    sizeof(struct track_seg) * (t->num_keys - idx - 1));
 	}
 	t->keys[idx] = *k;
+
+	/* the segments into and out of the new key */
+	update_segs(t, idx, idx + 1);
+	return 0;
+}
+
+/*
+ * Insert or replace a run of keys sorted by row, like calling
+ * sync_set_key() for each of them, but merging them in with a single pass
+ * over the keys after the first one.
+ */
+int sync_set_keys(struct sync_track *t, const struct track_key *keys,
+    int num_keys)
+{
+	int i, j, dst, start, num_new = 0;
+
+	if (!num_keys)
+		return 0;
+
+	start = sync_find_key(t, keys[0].row);
+	if (start < 0)
+		start = -start - 1;
+
+	/* count the rows that aren't already keyed */
+	for (i = start, j = 0; j < num_keys; ++j) {
+		assert(!j || keys[j - 1].row < keys[j].row);
+		while (i < t->num_keys && t->keys[i].row < keys[j].row)
+			i++;
+		if (i == t->num_keys || t->keys[i].row != keys[j].row)
+			num_new++;
+	}
+
+	if (reserve_keys(t, t->num_keys + num_new))
+		return -1;
+	if (num_new)
+		drop_index(t);
+
+	/* merge from the back, so nothing is overwritten before it's moved */
+	i = t->num_keys - 1;
+	j = num_keys - 1;
+	dst = t->num_keys + num_new - 1;
+	while (j >= 0) {
+		if (i >= start && t->keys[i].row > keys[j].row) {
+			t->keys[dst--] = t->keys[i--];
+		} else {
+			if (i >= start && t->keys[i].row == keys[j].row)
+				i--; /* replaced */
+			t->keys[dst--] = keys[j--];
+		}
+	}
+	assert(dst == i);
+
+	t->num_keys += num_new;
+	update_segs(t, start, t->num_keys);
 	return 0;
 }
 
 int sync_del_key(struct sync_track *t, int pos)
 {
-	void *tmp;
 	int idx = sync_find_key(t, pos);
 	assert(idx >= 0);
+	drop_index(t);
 	memmove(t->keys + idx, t->keys + idx + 1,
 	    sizeof(struct track_key) * (t->num_keys - idx - 1));
-	assert(t->keys);
-	tmp = realloc(t->keys, sizeof(struct track_key) *
-	    (t->num_keys - 1));
-	if (t->num_keys != 1 && !tmp)
-		return -1;
+	memmove(t->segs + idx + 1, t->segs + idx + 2,
+	    sizeof(struct track_seg) * (t->num_keys - idx - 1));
 	t->num_keys--;
-	t->keys = tmp;
+	t->kind = TRACK_UNCLASSIFIED;
+	t->serial++;
+
+	if (t->num_keys) {
+		/* the segment now spanning the gap */
+		update_segs(t, idx, idx);
+	}
+
+	trim_keys(t);
 	return 0;
 }
 #endif
@@ -19,23 +19,170 @@ struct track_key {
 	enum key_type type;
 };
 
+/*
+ * Evaluation-ready form of the segment starting at a key, see set_seg().
+ * A track with keys has num_keys + 1 of these, where segs[i + 1] starts
+ * at keys[i], and segs[0] is the constant before the first key.
+ */
+struct track_seg {
+	double row, inv_len;
+	double a[4];
+};
+
+/*
+ * Search index for tracks with many keys, where a binary search over the
+ * 12-byte keys mispredicts every other branch and, once the keys outgrow
+ * the cache, misses it on nearly every probe. It is a compact copy of the
+ * key rows, searched without branches so both candidate probes of the
+ * next step can be prefetched while the current one is loading.
+ */
+#define INDEX_MIN_KEYS 2048
+
+struct track_index {
+	int size;
+	int *rows;
+};
+
+/*
+ * The cheapest evaluator giving the same results as the general one, see
+ * sync_classify_track(). Evaluation only ever reads it: loaded tracks are
+ * classified up front, and edited ones are TRACK_UNCLASSIFIED, taking the
+ * general path, until sync_update() has applied all pending edits.
+ */
+enum track_kind {
+	TRACK_UNCLASSIFIED,
+	TRACK_CONSTANT, /* no keys, or a single value */
+	TRACK_STEP,     /* piecewise constant */
+	TRACK_LINEAR,   /* piecewise linear */
+	TRACK_MIXED
+};
+
+/* what sync_get_val() reads comes first, to share a cache line */
 struct sync_track {
-	char *name;
+	double frame_row, frame_val; /* see sync_begin_frame() */
 	struct track_key *keys;
+	struct track_seg *segs;
 	int num_keys;
+	int cursor; /* segment of the last lookup, only a hint, and racy */
+	enum track_kind kind;
+	unsigned serial; /* bumped by every edit, see struct sync_group */
+	unsigned frame_serial; /* serial of the cached value */
+	int frame_seg; /* key index at frame_row, for TRACK_STEP */
+	struct track_index *index; /* NULL when small, or stale after edits */
+	char *name;
+	int capacity;
+	float precision; /* bundle value step, see sync_set_precision() */
+	struct sync_track *volatile snapshot; /* see sync_publish() */
+#ifdef SYNC_PLAYER
+	struct sync_arena *arena; /* all of the above is allocated from here */
+	float *baked; /* see sync_bake_track() */
+	int num_baked;
+	double bake_row, bake_inv_step;
+#endif
+};
+
+/*
+ * Tracks evaluated together, e.g. the components of a vector. When all of
+ * them are keyed on the same rows, their segments are interleaved here so
+ * one search in the first track finds the segment of every component.
+ * Otherwise segs is NULL and the tracks are evaluated one by one.
+ */
+struct sync_group {
+	const struct sync_track **tracks;
+	int num_tracks;
+	unsigned *serials; /* of the tracks when segs was built */
+	struct track_seg *segs; /* segs[i * num_tracks + j] is tracks[j]->segs[i] */
 };
 
 int sync_find_key(const struct sync_track *, int);
+int sync_build_segs(struct sync_track *);
+int sync_build_index(struct sync_track *);
+void sync_classify_track(struct sync_track *);
+int sync_build_group(struct sync_group *);
+void sync_cache_val(struct sync_track *, double);
+
+/*
+ * Whether sync_get_vals() evaluates full batches with the widest SIMD
+ * kernel the CPU has, rather than the scalar one. Off by default, as it
+ * has yet to measure faster; tests and benchmarks turn it on to compare.
+ * The kernel is selected here, so call it before any thread evaluates.
+ */
+void sync_set_simd(int enable);
+struct sync_track *sync_snapshot_track(const struct sync_track *);
+void sync_free_snapshot(struct sync_track *);
+#ifdef SYNC_PLAYER
+/* tracks whose keys span more samples than this are left unbaked */
+#define MAX_BAKED (1 << 22)
+int sync_bake_track(struct sync_track *, int);
+
+struct sync_arena;
+void *sync_arena_alloc(struct sync_arena *, size_t);
+#endif
+
+#ifdef __GNUC__
+ #define sync_prefetch(addr) __builtin_prefetch(addr)
+#else
+ #define sync_prefetch(addr)
+#endif
+
+/* index of the last key at or before row, or -1 */
+static inline int index_floor(const struct track_index *ix, int row)
+{
+	const int *base = ix->rows;
+	int len = ix->size;
+
+	if (base[0] > row)
+		return -1;
+
+	while (len > 1) {
+		int half = len / 2;
+		sync_prefetch(base + len / 4);
+		sync_prefetch(base + half + len / 4);
+		base += (base[half] <= row) * half;
+		len -= half;
+	}
+	return (int)(base - ix->rows);
+}
+
+static inline int key_idx_in_segment(const struct sync_track *t, int idx,
+    int row)
+{
+	return idx >= -1 && idx < t->num_keys &&
+	    (idx < 0 || t->keys[idx].row <= row) &&
+	    (idx + 1 >= t->num_keys || t->keys[idx + 1].row > row);
+}
+
 static inline int key_idx_floor(const struct sync_track *t, int row)
 {
-	int idx = sync_find_key(t, row);
-	if (idx < 0)
-		idx = -idx - 2;
+	/*
+	 * Playback moves forward a frame at a time, so the segment of the
+	 * previous lookup or one of its neighbours is nearly always the
+	 * right one. The cursor is validated against the current keys
+	 * before use, so edits can never make us return a stale segment;
+	 * at worst we fall back to a full search. That also makes it safe
+	 * for the threads reading a snapshot to race on it.
+	 */
+	int idx = atomic_load_relaxed(&t->cursor);
+	if (!key_idx_in_segment(t, idx, row)) {
+		if (key_idx_in_segment(t, idx + 1, row))
+			idx++;
+		else if (key_idx_in_segment(t, idx - 1, row))
+			idx--;
+		else if (t->index)
+			idx = index_floor(t->index, row);
+		else {
+			idx = sync_find_key(t, row);
+			if (idx < 0)
+				idx = -idx - 2;
+		}
+		atomic_store_relaxed(&((struct sync_track *)t)->cursor, idx);
+	}
 	return idx;
 }
 
 #ifndef SYNC_PLAYER
 int sync_set_key(struct sync_track *, const struct track_key *);
+int sync_set_keys(struct sync_track *, const struct track_key *, int);
 int sync_del_key(struct sync_track *, int);
 static inline int is_key_frame(const struct sync_track *t, int row)
 {
@@ -0,0 +1,612 @@
+/* Compiles track data into a C translation unit.
+ *
+ *   track2c [-o out.c] [-p prefix] [-d] file.rocket
+ *   track2c [-o out.c] [-p prefix] [-d] -b base name...
+ *
+ * The first form reads an editor document, the second the .track files
+ * that sync_save_tracks() wrote for the named tracks. The output holds a
+ * constant key array per track, a table of the tracks sorted by name
+ * hash, and unless -d is given, one inline evaluation function per track
+ * that returns exactly what sync_get_val() would. Include it from the
+ * translation unit that evaluates the tracks, so the compiler can inline
+ * them into the render loop.
+ */
+
+#include "sync.h"
+#include "track.h"
+#include <ctype.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+struct gen_track {
+	char *name, *ident;
+	uint32_t hash;
+	struct sync_track *t;
+};
+
+static struct gen_track *tracks;
+static int num_tracks;
+static const char *prefix = "sync_gen";
+
+static void die(const char *fmt, const char *arg)
+{
+	fprintf(stderr, "track2c: ");
+	fprintf(stderr, fmt, arg);
+	fprintf(stderr, "\n");
+	exit(EXIT_FAILURE);
+}
+
+/* 32-bit FNV-1a, as used by the device */
+static uint32_t hash_name(const char *name)
+{
+	uint32_t hash = 2166136261u;
+	while (*name) {
+		hash ^= (unsigned char)*name++;
+		hash *= 16777619u;
+	}
+	return hash;
+}
+
+static struct gen_track *add_track(const char *name)
+{
+	struct gen_track *g;
+
+	tracks = realloc(tracks, sizeof(*tracks) * (num_tracks + 1));
+	if (!tracks)
+		die("out of memory%s", "");
+	g = tracks + num_tracks++;
+	g->name = strdup(name);
+	g->ident = NULL;
+	g->hash = hash_name(name);
+	g->t = NULL;
+	if (!g->name)
+		die("out of memory%s", "");
+	return g;
+}
+
+static char *read_file(const char *path)
+{
+	FILE *fp = fopen(path, "rb");
+	char *buf;
+	long size;
+
+	if (!fp)
+		die("cannot open %s", path);
+	fseek(fp, 0, SEEK_END);
+	size = ftell(fp);
+	rewind(fp);
+	buf = malloc(size + 1);
+	if (!buf || fread(buf, 1, size, fp) != (size_t)size)
+		die("cannot read %s", path);
+	buf[size] = '\0';
+	fclose(fp);
+	return buf;
+}
+
+/*
+ * Just enough XML for the editor's documents: tags with quoted
+ * attributes, the predefined entities, and comments and declarations to
+ * skip.
+ */
+struct attr {
+	char name[32];
+	char value[256];
+};
+
+static char *parse_tag(char *p, char *tag, size_t tag_size,
+    struct attr *attrs, int *num_attrs)
+{
+	size_t n = 0;
+
+	*num_attrs = 0;
+	while (*p && !isspace((unsigned char)*p) && *p != '>' &&
+	    !(*p == '/' && n)) {
+		if (n + 1 < tag_size)
+			tag[n++] = *p;
+		p++;
+	}
+	tag[n] = '\0';
+
+	while (*p && *p != '>') {
+		struct attr *a = attrs + *num_attrs;
+		char quote;
+
+		if (isspace((unsigned char)*p) || *p == '/') {
+			p++;
+			continue;
+		}
+		if (*num_attrs == 8)
+			die("too many attributes in <%s>", tag);
+
+		for (n = 0; *p && *p != '=' && !isspace((unsigned char)*p); ++p)
+			if (n + 1 < sizeof(a->name))
+				a->name[n++] = *p;
+		a->name[n] = '\0';
+		while (isspace((unsigned char)*p) || *p == '=')
+			p++;
+		quote = *p;
+		if (quote != '"' && quote != '\'')
+			die("unquoted attribute in <%s>", tag);
+
+		for (n = 0, ++p; *p && *p != quote; ++p) {
+			static const char *entities[] = {
+				"&amp;&", "&lt;<", "&gt;>", "&quot;\"", "&apos;'"
+			};
+			char ch = *p;
+			int i;
+			for (i = 0; ch == '&' && i < 5; ++i) {
+				size_t len = strlen(entities[i]) - 1;
+				if (!strncmp(p, entities[i], len)) {
+					ch = entities[i][len];
+					p += len - 1;
+				}
+			}
+			if (n + 1 < sizeof(a->value))
+				a->value[n++] = ch;
+		}
+		a->value[n] = '\0';
+		if (!*p)
+			die("unterminated attribute in <%s>", tag);
+		p++;
+		(*num_attrs)++;
+	}
+	return *p ? p + 1 : p;
+}
+
+static const char *get_attr(const struct attr *attrs, int num_attrs,
+    const char *name, const char *tag)
+{
+	int i;
+	for (i = 0; i < num_attrs; ++i)
+		if (!strcmp(attrs[i].name, name))
+			return attrs[i].value;
+	die("missing attribute in <%s>", tag);
+	return NULL;
+}
+
+static int compare_keys(const void *a, const void *b)
+{
+	const struct track_key *ka = a, *kb = b;
+	return ka->row < kb->row ? -1 : ka->row > kb->row;
+}
+
+static void finish_track(struct gen_track *g, struct track_key *keys,
+    int num_keys)
+{
+	struct sync_track *t = calloc(1, sizeof(*t));
+	int i;
+
+	if (!t)
+		die("out of memory%s", "");
+
+	/* keys is NULL for an empty track, which qsort must not see */
+	if (num_keys) {
+		qsort(keys, num_keys, sizeof(*keys), compare_keys);
+		for (i = 1; i < num_keys; ++i)
+			if (keys[i - 1].row == keys[i].row)
+				die("duplicate key in track %s", g->name);
+	}
+
+	t->name = g->name;
+	t->keys = keys;
+	t->num_keys = t->capacity = num_keys;
+	t->cursor = -1;
+	if (sync_build_segs(t))
+		die("out of memory%s", "");
+	g->t = t;
+}
+
+static void read_rocket(const char *path)
+{
+	char *buf = read_file(path), *p = buf;
+	struct gen_track *g = NULL;
+	struct track_key *keys = NULL;
+	int num_keys = 0;
+
+	while ((p = strchr(p, '<')) != NULL) {
+		struct attr attrs[8];
+		char tag[32];
+		int num_attrs;
+
+		if (!strncmp(p, "<!--", 4)) {
+			p = strstr(p, "-->");
+			if (!p)
+				die("unterminated comment in %s", path);
+			continue;
+		}
+		if (p[1] == '?' || p[1] == '!') {
+			p++;
+			continue;
+		}
+
+		p = parse_tag(p + 1, tag, sizeof(tag), attrs, &num_attrs);
+		if (!strcmp(tag, "track")) {
+			if (g)
+				die("nested <track> in %s", path);
+			g = add_track(get_attr(attrs, num_attrs, "name", tag));
+			keys = NULL;
+			num_keys = 0;
+			/* <track .../> has no keys */
+			if (p[-2] == '/') {
+				finish_track(g, keys, 0);
+				g = NULL;
+			}
+		} else if (!strcmp(tag, "/track")) {
+			if (!g)
+				die("unmatched </track> in %s", path);
+			finish_track(g, keys, num_keys);
+			g = NULL;
+		} else if (!strcmp(tag, "key")) {
+			struct track_key *k;
+			int type;
+
+			if (!g)
+				die("<key> outside of <track> in %s", path);
+			keys = realloc(keys, sizeof(*keys) * (num_keys + 1));
+			if (!keys)
+				die("out of memory%s", "");
+			k = keys + num_keys++;
+			k->row = atoi(get_attr(attrs, num_attrs, "row", tag));
+			k->value = (float)atof(get_attr(attrs, num_attrs,
+			    "value", tag));
+			type = atoi(get_attr(attrs, num_attrs, "interpolation",
+			    tag));
+			if (type < 0 || type >= KEY_TYPE_COUNT)
+				die("bad interpolation in track %s", g->name);
+			k->type = (enum key_type)type;
+		}
+	}
+	if (g)
+		die("unterminated <track> in %s", path);
+	free(buf);
+}
+
+/* load through the library, so .track files are read exactly as usual */
+static void read_track_files(const char *base, char **names, int count)
+{
+	struct sync_device *d = sync_create_device(base);
+	int i;
+
+	if (!d)
+		die("cannot create device for %s", base);
+
+	for (i = 0; i < count; ++i) {
+		const struct sync_track *t = sync_get_track(d, names[i]);
+		struct track_key *keys;
+
+		if (!t)
+			die("cannot load track %s", names[i]);
+		keys = malloc(sizeof(*keys) * (t->num_keys ? t->num_keys : 1));
+		if (!keys)
+			die("out of memory%s", "");
+		memcpy(keys, t->keys, sizeof(*keys) * t->num_keys);
+		finish_track(add_track(names[i]), keys, t->num_keys);
+	}
+	/* the device stays alive, it owns nothing we still use */
+}
+
+static void make_idents(void)
+{
+	int i, j;
+
+	for (i = 0; i < num_tracks; ++i) {
+		struct gen_track *g = tracks + i;
+		size_t len = strlen(prefix) + strlen(g->name) + 16;
+		char *s;
+
+		g->ident = malloc(len);
+		if (!g->ident)
+			die("out of memory%s", "");
+		sprintf(g->ident, "%s_%s", prefix, g->name);
+		for (s = g->ident + strlen(prefix) + 1; *s; ++s)
+			if (!isalnum((unsigned char)*s))
+				*s = '_';
+
+		/* "a.b" and "a:b" would clash */
+		for (j = 0; j < i; ++j)
+			if (!strcmp(tracks[j].ident, g->ident)) {
+				sprintf(g->ident + strlen(g->ident), "_%d", i);
+				break;
+			}
+	}
+}
+
+static int compare_hashes(const void *a, const void *b)
+{
+	const struct gen_track *ga = a, *gb = b;
+	if (ga->hash != gb->hash)
+		return ga->hash < gb->hash ? -1 : 1;
+	return strcmp(ga->name, gb->name);
+}
+
+/* a literal that reads back as exactly v, also for -0.0 */
+static const char *double_lit(double v)
+{
+	static char buf[2][64];
+	static int which;
+	char *s = buf[which ^= 1];
+
+	if (v != v || fabs(v) == HUGE_VAL)
+		die("non-finite value%s", "");
+	sprintf(s, "%.17g", v);
+	if (!strpbrk(s, ".e"))
+		strcat(s, ".0");
+	return s;
+}
+
+static const char *float_lit(float v)
+{
+	static char buf[64];
+
+	if (v != v || fabs(v) == HUGE_VAL)
+		die("non-finite value%s", "");
+	sprintf(buf, "%.9g", v);
+	if (!strpbrk(buf, ".e"))
+		strcat(buf, ".0");
+	strcat(buf, "f");
+	return buf;
+}
+
+static void write_string(FILE *fp, const char *s)
+{
+	fputc('"', fp);
+	for (; *s; ++s) {
+		if (*s == '"' || *s == '\\')
+			fprintf(fp, "\\%c", *s);
+		else if (isprint((unsigned char)*s))
+			fputc(*s, fp);
+		else
+			fprintf(fp, "\\%03o", (unsigned char)*s);
+	}
+	fputc('"', fp);
+}
+
+/* between array elements, per_line to a line */
+static const char *separator(int i, int per_line)
+{
+	if (!i)
+		return "\n\t\t";
+	return i % per_line ? ", " : ",\n\t\t";
+}
+
+/*
+ * The evaluators fold what they can, and otherwise run the library's
+ * own segment search and Horner step over the same coefficients, so the
+ * results are bit-identical to sync_get_val(). A STEP segment evaluates
+ * to a[0] + (+-0.0), which only differs from a[0] for -0.0.
+ */
+static void write_eval(FILE *fp, const struct gen_track *g)
+{
+	const struct sync_track *t = g->t;
+	int i, constant = 1, steps = 1;
+
+	/* a segment between equal values is as good as a STEP */
+	for (i = 0; i < t->num_keys; ++i) {
+		const struct track_key *k = t->keys + i;
+		if (k->value == 0.0f && 1.0f / k->value < 0.0f)
+			constant = steps = 0;
+		if (k->value != t->keys[0].value)
+			constant = 0;
+		if (i + 1 < t->num_keys && k->type != KEY_STEP &&
+		    k->value != k[1].value)
+			steps = 0;
+	}
+
+	fprintf(fp, "/* %s */\n", g->name);
+	fprintf(fp, "SYNC_GEN_INLINE double %s(double row)\n{\n", g->ident);
+
+	if (!t->num_keys) {
+		fprintf(fp, "\t(void)row;\n\treturn 0.0;\n}\n\n");
+		return;
+	}
+	if (constant) {
+		fprintf(fp, "\t(void)row;\n\treturn %s;\n}\n\n",
+		    double_lit(t->keys[0].value));
+		return;
+	}
+
+	fprintf(fp, "\tstatic const int rows[%d] = {", t->num_keys);
+	for (i = 0; i < t->num_keys; ++i)
+		fprintf(fp, "%s%d", separator(i, 8), t->keys[i].row);
+	fprintf(fp, "\n\t};\n");
+
+	if (steps) {
+		fprintf(fp, "\tstatic const double values[%d] = {",
+		    t->num_keys + 1);
+		for (i = 0; i <= t->num_keys; ++i)
+			fprintf(fp, "%s%s", separator(i, 4),
+			    double_lit(t->keys[i ? i - 1 : 0].value));
+		fprintf(fp, "\n\t};\n");
+	} else {
+		fprintf(fp, "\tstatic const double segs[%d][6] = {\n",
+		    t->num_keys + 1);
+		for (i = 0; i <= t->num_keys; ++i) {
+			const struct track_seg *s = t->segs + i;
+			fprintf(fp, "\t\t{ %s, ", double_lit(s->row));
+			fprintf(fp, "%s,\n", double_lit(s->inv_len));
+			fprintf(fp, "\t\t  %s, ", double_lit(s->a[0]));
+			fprintf(fp, "%s, ", double_lit(s->a[1]));
+			fprintf(fp, "%s, ", double_lit(s->a[2]));
+			fprintf(fp, "%s },\n", double_lit(s->a[3]));
+		}
+		fprintf(fp, "\t};\n\tconst double *s;\n\tdouble x;\n");
+	}
+
+	fprintf(fp,
+	    "\tint lo = 0, hi = %d, irow = (int)floor(row);\n"
+	    "\n"
+	    "\t/* number of keys at or before row */\n"
+	    "\twhile (lo < hi) {\n"
+	    "\t\tint mi = (lo + hi) / 2;\n"
+	    "\t\tif (rows[mi] <= irow)\n"
+	    "\t\t\tlo = mi + 1;\n"
+	    "\t\telse\n"
+	    "\t\t\thi = mi;\n"
+	    "\t}\n", t->num_keys);
+
+	if (steps)
+		fprintf(fp, "\treturn values[lo];\n}\n\n");
+	else
+		fprintf(fp,
+		    "\ts = segs[lo];\n"
+		    "\tx = (row - s[0]) * s[1];\n"
+		    "\treturn s[2] + x * (s[3] + x * (s[4] + x * s[5]));\n"
+		    "}\n\n");
+}
+
+static void write_unit(FILE *fp, const char *source, int evaluators)
+{
+	char upper[64];
+	int i, j;
+
+	for (i = 0; prefix[i] && i + 1 < (int)sizeof(upper); ++i)
+		upper[i] = (char)toupper((unsigned char)prefix[i]);
+	upper[i] = '\0';
+
+	fprintf(fp, "/* Generated by track2c from %s, do not edit. */\n\n",
+	    source);
+	fprintf(fp,
+	    "#include <math.h>\n"
+	    "#include <string.h>\n"
+	    "\n"
+	    "#ifndef SYNC_GEN_INLINE\n"
+	    " #if (!defined(__STDC_VERSION__) || (__STDC_VERSION__ < 199901L)) && !defined(__cplusplus)\n"
+	    "  #define SYNC_GEN_INLINE static __inline\n"
+	    " #else\n"
+	    "  #define SYNC_GEN_INLINE static inline\n"
+	    " #endif\n"
+	    "#endif\n"
+	    "\n"
+	    "/* type is an enum key_type */\n"
+	    "struct %s_key {\n"
+	    "\tint row;\n"
+	    "\tfloat value;\n"
+	    "\tint type;\n"
+	    "};\n"
+	    "\n"
+	    "struct %s_track {\n"
+	    "\tconst char *name;\n"
+	    "\tunsigned long hash; /* 32-bit FNV-1a of name */\n"
+	    "\tconst struct %s_key *keys;\n"
+	    "\tint num_keys;\n"
+	    "\tdouble (*eval)(double row); /* NULL unless generated */\n"
+	    "};\n"
+	    "\n", prefix, prefix, prefix);
+
+	for (i = 0; i < num_tracks; ++i) {
+		const struct sync_track *t = tracks[i].t;
+		if (!t->num_keys)
+			continue;
+		fprintf(fp, "static const struct %s_key %s_keys[%d] = {\n",
+		    prefix, tracks[i].ident, t->num_keys);
+		for (j = 0; j < t->num_keys; ++j)
+			fprintf(fp, "\t{ %d, %s, %d },\n", t->keys[j].row,
+			    float_lit(t->keys[j].value), (int)t->keys[j].type);
+		fprintf(fp, "};\n\n");
+	}
+
+	if (evaluators)
+		for (i = 0; i < num_tracks; ++i)
+			write_eval(fp, tracks + i);
+
+	fprintf(fp, "#define %s_NUM_TRACKS %d\n\n", upper, num_tracks);
+	fprintf(fp, "/* sorted by hash, see %s_find_track() */\n", prefix);
+	fprintf(fp, "static const struct %s_track %s_tracks[%d] = {\n",
+	    prefix, prefix, num_tracks ? num_tracks : 1);
+	for (i = 0; i < num_tracks; ++i) {
+		const struct gen_track *g = tracks + i;
+		fprintf(fp, "\t{ ");
+		write_string(fp, g->name);
+		fprintf(fp, ", 0x%08lxul, ", (unsigned long)g->hash);
+		if (g->t->num_keys)
+			fprintf(fp, "%s_keys, %d, ", g->ident, g->t->num_keys);
+		else
+			fprintf(fp, "NULL, 0, ");
+		fprintf(fp, "%s },\n", evaluators ? g->ident : "NULL");
+	}
+	if (!num_tracks)
+		fprintf(fp, "\t{ NULL, 0, NULL, 0, NULL },\n");
+	fprintf(fp, "};\n\n");
+
+	fprintf(fp,
+	    "SYNC_GEN_INLINE const struct %s_track *%s_find_track("
+	    "const char *name)\n"
+	    "{\n"
+	    "\tunsigned long hash = 2166136261ul;\n"
+	    "\tint lo = 0, hi = %s_NUM_TRACKS;\n"
+	    "\tconst char *p;\n"
+	    "\n"
+	    "\tfor (p = name; *p; ++p)\n"
+	    "\t\thash = ((hash ^ (unsigned char)*p) * 16777619ul) &"
+	    " 0xfffffffful;\n"
+	    "\n"
+	    "\twhile (lo < hi) {\n"
+	    "\t\tint mi = (lo + hi) / 2;\n"
+	    "\t\tif (%s_tracks[mi].hash < hash)\n"
+	    "\t\t\tlo = mi + 1;\n"
+	    "\t\telse\n"
+	    "\t\t\thi = mi;\n"
+	    "\t}\n"
+	    "\tfor (; lo < %s_NUM_TRACKS && %s_tracks[lo].hash == hash;"
+	    " ++lo)\n"
+	    "\t\tif (!strcmp(%s_tracks[lo].name, name))\n"
+	    "\t\t\treturn %s_tracks + lo;\n"
+	    "\treturn NULL;\n"
+	    "}\n", prefix, prefix, upper, prefix, upper, prefix, prefix,
+	    prefix);
+}
+
+static void usage(void)
+{
+	fprintf(stderr,
+	    "usage: track2c [-o out.c] [-p prefix] [-d] file.rocket\n"
+	    "       track2c [-o out.c] [-p prefix] [-d] -b base name...\n");
+	exit(EXIT_FAILURE);
+}
+
+int main(int argc, char *argv[])
+{
+	const char *out = NULL, *base = NULL;
+	int i, evaluators = 1;
+	FILE *fp = stdout;
+
+	for (i = 1; i < argc && argv[i][0] == '-'; ++i) {
+		if (!strcmp(argv[i], "-d"))
+			evaluators = 0;
+		else if (i + 1 == argc)
+			usage();
+		else if (!strcmp(argv[i], "-o"))
+			out = argv[++i];
+		else if (!strcmp(argv[i], "-p"))
+			prefix = argv[++i];
+		else if (!strcmp(argv[i], "-b"))
+			base = argv[++i];
+		else
+			usage();
+	}
+
+	if (base)
+		read_track_files(base, argv + i, argc - i);
+	else if (i + 1 == argc)
+		read_rocket(argv[i]);
+	else
+		usage();
+
+	make_idents();
+	qsort(tracks, num_tracks, sizeof(*tracks), compare_hashes);
+
+	if (out) {
+		fp = fopen(out, "w");
+		if (!fp)
+			die("cannot create %s", out);
+	}
+	write_unit(fp, base ? base : argv[i], evaluators);
+	if (ferror(fp) || (out && fclose(fp))) {
+		if (out)
+			remove(out);
+		die("cannot write %s", out ? out : "output");
+	}
+	return EXIT_SUCCESS;
+}
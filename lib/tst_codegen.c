@@ -0,0 +1,86 @@
+/* Tests for track2c, run with `make check`. */
+
+#include "sync.h"
+#include "track.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "tst_codegen.gen.c"
+
+static int failures;
+
+#define CHECK(expr) \
+	do { \
+		if (!(expr)) { \
+			fprintf(stderr, "%s:%d: check failed: %s\n", \
+			    __FILE__, __LINE__, #expr); \
+			failures++; \
+		} \
+	} while (0)
+
+/* bit for bit, so -0.0 and 0.0 differ */
+static int same(double a, double b)
+{
+	return !memcmp(&a, &b, sizeof(double));
+}
+
+/* every evaluator must match sync_get_val() on the same keys */
+static void test_eval(struct sync_device *d, const struct tst_track *g)
+{
+	struct sync_track *t = (struct sync_track *)sync_get_track(d, g->name);
+	int i, first = -64, last = 64;
+
+	for (i = 0; i < g->num_keys; ++i) {
+		struct track_key k;
+		k.row = g->keys[i].row;
+		k.value = g->keys[i].value;
+		k.type = (enum key_type)g->keys[i].type;
+		CHECK(!sync_set_key(t, &k));
+	}
+	if (g->num_keys) {
+		first = g->keys[0].row - 64;
+		last = g->keys[g->num_keys - 1].row + 64;
+	}
+
+	for (i = first * 16; i <= last * 16; ++i) {
+		double row = i / 16.0;
+		if (!same(g->eval(row), sync_get_val(t, row))) {
+			fprintf(stderr, "%s at row %g: %.17g, expected %.17g\n",
+			    g->name, row, g->eval(row), sync_get_val(t, row));
+			failures++;
+			break;
+		}
+	}
+}
+
+int main(void)
+{
+	struct sync_device *d = sync_create_device("tst_codegen");
+	int i;
+
+	CHECK(TST_NUM_TRACKS == 8);
+	for (i = 0; i < TST_NUM_TRACKS; ++i) {
+		CHECK(tst_find_track(tst_tracks[i].name) == tst_tracks + i);
+		test_eval(d, tst_tracks + i);
+	}
+	CHECK(!tst_find_track("missing"));
+
+	/* parsed from the document, with keys sorted and entities expanded */
+	CHECK(tst_find_track("empty")->num_keys == 0);
+	CHECK(tst_find_track("steps")->keys[1].row == 4);
+	CHECK(tst_find_track("steps")->keys[1].value == 0.1f);
+	CHECK(tst_find_track("cam:pos.x & \"y\"")->num_keys == 8);
+	CHECK(tst_find_track("cam:pos.x & 'y'")->keys[0].type == KEY_SMOOTH);
+
+	/* and folded where possible */
+	CHECK(tst_const(-1e6) == 2.5 && tst_flat(1e6) == 1.25);
+
+	sync_destroy_device(d);
+
+	if (failures) {
+		fprintf(stderr, "%d check(s) failed\n", failures);
+		return EXIT_FAILURE;
+	}
+	return EXIT_SUCCESS;
+}
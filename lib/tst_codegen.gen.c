@@ -0,0 +1,303 @@
+/* Generated by track2c from lib/tst_codegen.rocket, do not edit. */
+
+#include <math.h>
+#include <string.h>
+
+#ifndef SYNC_GEN_INLINE
+ #if (!defined(__STDC_VERSION__) || (__STDC_VERSION__ < 199901L)) && !defined(__cplusplus)
+  #define SYNC_GEN_INLINE static __inline
+ #else
+  #define SYNC_GEN_INLINE static inline
+ #endif
+#endif
+
+/* type is an enum key_type */
+struct tst_key {
+	int row;
+	float value;
+	int type;
+};
+
+struct tst_track {
+	const char *name;
+	unsigned long hash; /* 32-bit FNV-1a of name */
+	const struct tst_key *keys;
+	int num_keys;
+	double (*eval)(double row); /* NULL unless generated */
+};
+
+static const struct tst_key tst_cam_pos_x____y__7_keys[2] = {
+	{ 0, 0.0f, 2 },
+	{ 3, 1.0f, 0 },
+};
+
+static const struct tst_key tst_steps_keys[6] = {
+	{ 0, 1.0f, 0 },
+	{ 4, 0.100000001f, 0 },
+	{ 16, -3.5f, 0 },
+	{ 40, 7.0f, 1 },
+	{ 64, 7.0f, 0 },
+	{ 65, 0.00100000005f, 2 },
+};
+
+static const struct tst_key tst_cam_pos_x____y__keys[8] = {
+	{ -20, -10.0f, 1 },
+	{ -3, 0.333332986f, 2 },
+	{ 0, 12.75f, 3 },
+	{ 7, 3.0f, 0 },
+	{ 8, -100000.0f, 1 },
+	{ 100, 42.0f, 2 },
+	{ 301, 0.5f, 3 },
+	{ 333, 1.0f, 1 },
+};
+
+static const struct tst_key tst_const_keys[1] = {
+	{ 12, 2.5f, 1 },
+};
+
+static const struct tst_key tst_negzero_keys[3] = {
+	{ -8, -0.0f, 0 },
+	{ 3, 0.0f, 0 },
+	{ 9, -0.0f, 1 },
+};
+
+static const struct tst_key tst_flat_keys[3] = {
+	{ -4, 1.25f, 2 },
+	{ 8, 1.25f, 0 },
+	{ 30, 1.25f, 3 },
+};
+
+static const struct tst_key tst_linear_keys[6] = {
+	{ -7, 0.300000012f, 1 },
+	{ 2, 0.300000012f, 2 },
+	{ 5, 0.300000012f, 1 },
+	{ 11, -2.75f, 0 },
+	{ 13, 6.0f, 1 },
+	{ 50, 1.00000001e-07f, 1 },
+};
+
+/* empty */
+SYNC_GEN_INLINE double tst_empty(double row)
+{
+	(void)row;
+	return 0.0;
+}
+
+/* cam:pos.x & 'y' */
+SYNC_GEN_INLINE double tst_cam_pos_x____y__7(double row)
+{
+	static const int rows[2] = {
+		0, 3
+	};
+	static const double segs[3][6] = {
+		{ 0.0, 0.0,
+		  0.0, 0.0, 0.0, 0.0 },
+		{ 0.0, 0.33333333333333331,
+		  0.0, 0.0, 3.0, -2.0 },
+		{ 0.0, 0.0,
+		  1.0, 0.0, 0.0, 0.0 },
+	};
+	const double *s;
+	double x;
+	int lo = 0, hi = 2, irow = (int)floor(row);
+
+	/* number of keys at or before row */
+	while (lo < hi) {
+		int mi = (lo + hi) / 2;
+		if (rows[mi] <= irow)
+			lo = mi + 1;
+		else
+			hi = mi;
+	}
+	s = segs[lo];
+	x = (row - s[0]) * s[1];
+	return s[2] + x * (s[3] + x * (s[4] + x * s[5]));
+}
+
+/* steps */
+SYNC_GEN_INLINE double tst_steps(double row)
+{
+	static const int rows[6] = {
+		0, 4, 16, 40, 64, 65
+	};
+	static const double values[7] = {
+		1.0, 1.0, 0.10000000149011612, -3.5,
+		7.0, 7.0, 0.0010000000474974513
+	};
+	int lo = 0, hi = 6, irow = (int)floor(row);
+
+	/* number of keys at or before row */
+	while (lo < hi) {
+		int mi = (lo + hi) / 2;
+		if (rows[mi] <= irow)
+			lo = mi + 1;
+		else
+			hi = mi;
+	}
+	return values[lo];
+}
+
+/* cam:pos.x & "y" */
+SYNC_GEN_INLINE double tst_cam_pos_x____y_(double row)
+{
+	static const int rows[8] = {
+		-20, -3, 0, 7, 8, 100, 301, 333
+	};
+	static const double segs[9][6] = {
+		{ 0.0, 0.0,
+		  -10.0, 0.0, 0.0, 0.0 },
+		{ -20.0, 0.058823529411764705,
+		  -10.0, 10.333333015441895, 0.0, 0.0 },
+		{ -3.0, 0.33333333333333331,
+		  0.33333298563957214, 0.0, 37.250000953674316, -24.833333969116211 },
+		{ 0.0, 0.14285714285714285,
+		  12.75, 0.0, -9.75, 0.0 },
+		{ 0.0, 0.0,
+		  3.0, 0.0, 0.0, 0.0 },
+		{ 8.0, 0.010869565217391304,
+		  -100000.0, 100042.0, 0.0, 0.0 },
+		{ 100.0, 0.0049751243781094526,
+		  42.0, 0.0, -124.5, 83.0 },
+		{ 301.0, 0.03125,
+		  0.5, 0.0, 0.5, 0.0 },
+		{ 0.0, 0.0,
+		  1.0, 0.0, 0.0, 0.0 },
+	};
+	const double *s;
+	double x;
+	int lo = 0, hi = 8, irow = (int)floor(row);
+
+	/* number of keys at or before row */
+	while (lo < hi) {
+		int mi = (lo + hi) / 2;
+		if (rows[mi] <= irow)
+			lo = mi + 1;
+		else
+			hi = mi;
+	}
+	s = segs[lo];
+	x = (row - s[0]) * s[1];
+	return s[2] + x * (s[3] + x * (s[4] + x * s[5]));
+}
+
+/* const */
+SYNC_GEN_INLINE double tst_const(double row)
+{
+	(void)row;
+	return 2.5;
+}
+
+/* negzero */
+SYNC_GEN_INLINE double tst_negzero(double row)
+{
+	static const int rows[3] = {
+		-8, 3, 9
+	};
+	static const double segs[4][6] = {
+		{ 0.0, 0.0,
+		  -0.0, 0.0, 0.0, 0.0 },
+		{ 0.0, 0.0,
+		  -0.0, 0.0, 0.0, 0.0 },
+		{ 0.0, 0.0,
+		  0.0, 0.0, 0.0, 0.0 },
+		{ 0.0, 0.0,
+		  -0.0, 0.0, 0.0, 0.0 },
+	};
+	const double *s;
+	double x;
+	int lo = 0, hi = 3, irow = (int)floor(row);
+
+	/* number of keys at or before row */
+	while (lo < hi) {
+		int mi = (lo + hi) / 2;
+		if (rows[mi] <= irow)
+			lo = mi + 1;
+		else
+			hi = mi;
+	}
+	s = segs[lo];
+	x = (row - s[0]) * s[1];
+	return s[2] + x * (s[3] + x * (s[4] + x * s[5]));
+}
+
+/* flat */
+SYNC_GEN_INLINE double tst_flat(double row)
+{
+	(void)row;
+	return 1.25;
+}
+
+/* linear */
+SYNC_GEN_INLINE double tst_linear(double row)
+{
+	static const int rows[6] = {
+		-7, 2, 5, 11, 13, 50
+	};
+	static const double segs[7][6] = {
+		{ 0.0, 0.0,
+		  0.30000001192092896, 0.0, 0.0, 0.0 },
+		{ -7.0, 0.1111111111111111,
+		  0.30000001192092896, 0.0, 0.0, 0.0 },
+		{ 2.0, 0.33333333333333331,
+		  0.30000001192092896, 0.0, 0.0, -0.0 },
+		{ 5.0, 0.16666666666666666,
+		  0.30000001192092896, -3.0499999523162842, 0.0, 0.0 },
+		{ 0.0, 0.0,
+		  -2.75, 0.0, 0.0, 0.0 },
+		{ 13.0, 0.027027027027027029,
+		  6.0, -6.0, 0.0, 0.0 },
+		{ 0.0, 0.0,
+		  1.0000000116860974e-07, 0.0, 0.0, 0.0 },
+	};
+	const double *s;
+	double x;
+	int lo = 0, hi = 6, irow = (int)floor(row);
+
+	/* number of keys at or before row */
+	while (lo < hi) {
+		int mi = (lo + hi) / 2;
+		if (rows[mi] <= irow)
+			lo = mi + 1;
+		else
+			hi = mi;
+	}
+	s = segs[lo];
+	x = (row - s[0]) * s[1];
+	return s[2] + x * (s[3] + x * (s[4] + x * s[5]));
+}
+
+#define TST_NUM_TRACKS 8
+
+/* sorted by hash, see tst_find_track() */
+static const struct tst_track tst_tracks[8] = {
+	{ "empty", 0x18a7beeeul, NULL, 0, tst_empty },
+	{ "cam:pos.x & 'y'", 0x1d3a30adul, tst_cam_pos_x____y__7_keys, 2, tst_cam_pos_x____y__7 },
+	{ "steps", 0x2c35b134ul, tst_steps_keys, 6, tst_steps },
+	{ "cam:pos.x & \"y\"", 0x4257add1ul, tst_cam_pos_x____y__keys, 8, tst_cam_pos_x____y_ },
+	{ "const", 0x664fd1d4ul, tst_const_keys, 1, tst_const },
+	{ "negzero", 0x8f86e32ful, tst_negzero_keys, 3, tst_negzero },
+	{ "flat", 0xceeac39aul, tst_flat_keys, 3, tst_flat },
+	{ "linear", 0xd00594c0ul, tst_linear_keys, 6, tst_linear },
+};
+
+SYNC_GEN_INLINE const struct tst_track *tst_find_track(const char *name)
+{
+	unsigned long hash = 2166136261ul;
+	int lo = 0, hi = TST_NUM_TRACKS;
+	const char *p;
+
+	for (p = name; *p; ++p)
+		hash = ((hash ^ (unsigned char)*p) * 16777619ul) & 0xfffffffful;
+
+	while (lo < hi) {
+		int mi = (lo + hi) / 2;
+		if (tst_tracks[mi].hash < hash)
+			lo = mi + 1;
+		else
+			hi = mi;
+	}
+	for (; lo < TST_NUM_TRACKS && tst_tracks[lo].hash == hash; ++lo)
+		if (!strcmp(tst_tracks[lo].name, name))
+			return tst_tracks + lo;
+	return NULL;
+}
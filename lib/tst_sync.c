@@ -0,0 +1,1430 @@
+/* Tests for the sync library, run with `make check`. */
+
+#include "sync.h"
+#include "device.h"
+#include "track.h"
+#include "bundle.h"
+#include "sync_inline.h"
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+static int failures;
+
+#define CHECK(expr) \
+	do { \
+		if (!(expr)) { \
+			fprintf(stderr, "%s:%d: check failed: %s\n", \
+			    __FILE__, __LINE__, #expr); \
+			failures++; \
+		} \
+	} while (0)
+
+/* write a track the way save_track() does */
+static void write_track(const char *path, const struct track_key *keys,
+    int num_keys)
+{
+	FILE *fp = fopen(path, "wb");
+	int i;
+
+	if (!fp) {
+		perror(path);
+		exit(EXIT_FAILURE);
+	}
+
+	fwrite(&num_keys, sizeof(int), 1, fp);
+	for (i = 0; i < num_keys; ++i) {
+		char type = (char)keys[i].type;
+		fwrite(&keys[i].row, sizeof(int), 1, fp);
+		fwrite(&keys[i].value, sizeof(float), 1, fp);
+		fwrite(&type, sizeof(char), 1, fp);
+	}
+	fclose(fp);
+}
+
+static const char *track_names[] = { "step", "linear", "smooth", "ramp",
+    "mixed", "single" };
+#define NUM_TRACKS (int)(sizeof(track_names) / sizeof(track_names[0]))
+
+static void write_tracks(void)
+{
+	struct track_key keys[64];
+	char path[64];
+	int i, j;
+
+	for (i = 0; i < NUM_TRACKS; ++i) {
+		int num_keys = i == NUM_TRACKS - 1 ? 1 : 64;
+		for (j = 0; j < num_keys; ++j) {
+			keys[j].row = j * 7 + (j * j) % 5;
+			keys[j].value = (float)((j * 37) % 23) - 11.5f;
+			keys[j].type = (enum key_type)(i < KEY_TYPE_COUNT ?
+			    i : (j % KEY_TYPE_COUNT));
+		}
+		snprintf(path, sizeof(path), "tst_sync_%s.track",
+		    track_names[i]);
+		write_track(path, keys, num_keys);
+	}
+}
+
+static void remove_tracks(void)
+{
+	char path[64];
+	int i;
+	for (i = 0; i < NUM_TRACKS; ++i) {
+		snprintf(path, sizeof(path), "tst_sync_%s.track",
+		    track_names[i]);
+		remove(path);
+	}
+}
+
+/* a key count that doesn't match the file size must not load */
+static void test_bad_size(void)
+{
+	struct sync_device *d = sync_create_device("tst_sync");
+	struct track_key keys[4];
+	FILE *fp;
+	int i, num_keys = 5;
+
+	for (i = 0; i < 4; ++i) {
+		keys[i].row = i;
+		keys[i].value = (float)i;
+		keys[i].type = KEY_LINEAR;
+	}
+	write_track("tst_sync_short.track", keys, 4);
+	fp = fopen("tst_sync_short.track", "r+b");
+	fwrite(&num_keys, sizeof(int), 1, fp);
+	fclose(fp);
+
+	write_track("tst_sync_long.track", keys, 4);
+	fp = fopen("tst_sync_long.track", "r+b");
+	num_keys = 3;
+	fwrite(&num_keys, sizeof(int), 1, fp);
+	fclose(fp);
+
+	write_track("tst_sync_huge.track", keys, 4);
+	fp = fopen("tst_sync_huge.track", "r+b");
+	num_keys = 0x7fffffff;
+	fwrite(&num_keys, sizeof(int), 1, fp);
+	fclose(fp);
+
+	CHECK(sync_get_track(d, "short")->num_keys == 0);
+	CHECK(sync_get_track(d, "long")->num_keys == 0);
+	CHECK(sync_get_track(d, "huge")->num_keys == 0);
+	CHECK(sync_get_val(sync_get_track(d, "short"), 2.0) == 0.0);
+
+	sync_destroy_device(d);
+	remove("tst_sync_short.track");
+	remove("tst_sync_long.track");
+	remove("tst_sync_huge.track");
+}
+
+/* sync_get_val_inline() must match sync_get_val(), also right after edits */
+static void test_inline(void)
+{
+	struct sync_device *d = sync_create_device("tst_sync");
+	int i, j;
+
+#ifdef SYNC_PLAYER
+	sync_set_bake_resolution(d, 4);
+#endif
+	for (i = 0; i < NUM_TRACKS; ++i) {
+		const struct sync_track *t = sync_get_track(d, track_names[i]);
+
+		/* the first evaluation classifies, through the fallback */
+		CHECK(sync_get_val_inline(t, 3.5) == sync_get_val(t, 3.5));
+		for (j = -40; j < 1000; ++j)
+			CHECK(sync_get_val_inline(t, j * 0.55) ==
+			    sync_get_val(t, j * 0.55));
+
+#ifndef SYNC_PLAYER
+		{
+			struct track_key key;
+			key.row = 100;
+			key.value = 42.0f;
+			key.type = KEY_SMOOTH;
+			CHECK(!sync_set_key((struct sync_track *)t, &key));
+			CHECK(sync_get_val_inline(t, 101.5) ==
+			    sync_get_val(t, 101.5));
+			for (j = -40; j < 1000; ++j)
+				CHECK(sync_get_val_inline(t, j * 0.55) ==
+				    sync_get_val(t, j * 0.55));
+		}
+#endif
+	}
+
+	sync_destroy_device(d);
+}
+
+/* bit for bit, so -0.0 and 0.0 differ */
+static int same(double a, double b)
+{
+	return !memcmp(&a, &b, sizeof(double));
+}
+
+/*
+ * The SIMD and scalar kernels must agree bit for bit with each other and
+ * with sync_get_val(), for full batches and the scalar tail alike.
+ */
+static void test_simd(int bake_step)
+{
+	struct sync_device *d = sync_create_device("tst_sync");
+	const struct sync_track *tracks[3 * NUM_TRACKS + 1];
+	double simd[3 * NUM_TRACKS + 1], scalar[3 * NUM_TRACKS + 1];
+	int i, j, n = 3 * NUM_TRACKS + 1;
+
+#ifdef SYNC_PLAYER
+	sync_set_bake_resolution(d, bake_step);
+#else
+	(void)bake_step;
+#endif
+	for (i = 0; i < n - 1; ++i)
+		tracks[i] = sync_get_track(d, track_names[i % NUM_TRACKS]);
+	tracks[n - 1] = sync_get_track(d, "none");
+
+	for (j = -40; j < 1000; ++j) {
+		double row = j * 0.55;
+		sync_set_simd(1);
+		sync_get_vals(tracks, n, row, simd);
+		sync_set_simd(0);
+		sync_get_vals(tracks, n, row, scalar);
+		for (i = 0; i < n; ++i)
+			CHECK(same(simd[i], scalar[i]) &&
+			    same(simd[i], sync_get_val(tracks[i], row)));
+	}
+	sync_set_simd(0);
+
+	sync_destroy_device(d);
+}
+
+/*
+ * sync_get_vals_range() walks the keys along with the samples, and must
+ * give the same bits as sync_get_val() at each, whichever way it walks.
+ */
+static void test_range(int bake_step)
+{
+	static const double steps[] = { 0.25, 1.0, 7.5, -0.5, -3.0, 0.0 };
+	static const double starts[] = { -20.5, 0.0, 37.3, 600.0 };
+	struct sync_device *d = sync_create_device("tst_sync");
+	double out[400];
+	int i, j, k, n;
+
+#ifdef SYNC_PLAYER
+	sync_set_bake_resolution(d, bake_step);
+#else
+	(void)bake_step;
+#endif
+	for (i = 0; i <= NUM_TRACKS; ++i) {
+		const struct sync_track *t = sync_get_track(d,
+		    i < NUM_TRACKS ? track_names[i] : "none");
+#ifdef SYNC_PLAYER
+		CHECK(!t->num_keys || !bake_step == !t->baked);
+#endif
+		for (j = 0; j < (int)(sizeof(steps) / sizeof(steps[0])); ++j)
+			for (k = 0; k < (int)(sizeof(starts) / sizeof(starts[0]));
+			    ++k) {
+				sync_get_vals_range(t, starts[k], steps[j], 400,
+				    out);
+				for (n = 0; n < 400; ++n)
+					CHECK(same(out[n], sync_get_val(t,
+					    starts[k] + steps[j] * n)));
+			}
+	}
+
+	sync_destroy_device(d);
+}
+
+static void check_group(const struct sync_group *g)
+{
+	double vals[NUM_TRACKS];
+	float valsf[NUM_TRACKS];
+	int i, j;
+
+	for (i = -40; i < 1000; ++i) {
+		double row = i * 0.55;
+		sync_get_group_vals(g, row, vals);
+		sync_get_group_valsf(g, row, valsf);
+		for (j = 0; j < g->num_tracks; ++j) {
+			double v = sync_get_val(g->tracks[j], row);
+			CHECK(same(vals[j], v));
+			CHECK(valsf[j] == (float)v);
+		}
+	}
+}
+
+/* groups must evaluate like their tracks, shared rows or not */
+static void test_group(int bake_step)
+{
+	struct sync_device *d = sync_create_device("tst_sync");
+	const struct sync_track *tracks[NUM_TRACKS];
+	const struct sync_group *g, *all;
+	int i;
+
+#ifdef SYNC_PLAYER
+	sync_set_bake_resolution(d, bake_step);
+#endif
+	for (i = 0; i < NUM_TRACKS; ++i)
+		tracks[i] = sync_get_track(d, track_names[i]);
+
+	/* all but "single" are keyed on the same rows */
+	g = sync_get_group(d, tracks, NUM_TRACKS - 1);
+	CHECK(g && (g->segs != NULL) == !bake_step);
+	check_group(g);
+	CHECK(sync_get_group(d, tracks, NUM_TRACKS - 1) == g);
+
+	all = sync_get_group(d, tracks, NUM_TRACKS);
+	CHECK(all && all != g && !all->segs);
+	check_group(all);
+	CHECK(!sync_get_group(d, tracks, 0));
+
+#ifndef SYNC_PLAYER
+	{
+		struct track_key key;
+		key.row = 100;
+		key.value = 42.0f;
+		key.type = KEY_SMOOTH;
+
+		/* a key on one component only splits the rows */
+		CHECK(!sync_set_key((struct sync_track *)tracks[1], &key));
+		check_group(g);
+		CHECK(!g->segs);
+
+		for (i = 0; i < NUM_TRACKS - 1; ++i)
+			if (i != 1)
+				CHECK(!sync_set_key((struct sync_track *)tracks[i],
+				    &key));
+		check_group(g);
+		CHECK(g->segs);
+
+		CHECK(!sync_del_key((struct sync_track *)tracks[3], 100));
+		check_group(g);
+		CHECK(!g->segs);
+	}
+#endif
+
+	sync_destroy_device(d);
+}
+
+static void check_frame(struct sync_device *d,
+    const struct sync_track **tracks, double row)
+{
+	int i;
+
+	sync_begin_frame(d, row);
+	for (i = 0; i < NUM_TRACKS; ++i) {
+		CHECK(tracks[i]->frame_row == row);
+		CHECK(same(sync_get_val(tracks[i], row),
+		    sync_get_val_inline(tracks[i], row)));
+	}
+}
+
+/* sync_get_val() must not tell whether the frame cache answered */
+static void test_frame(int bake_step)
+{
+	struct sync_device *d = sync_create_device("tst_sync");
+	const struct sync_track *tracks[NUM_TRACKS];
+	int i;
+
+#ifdef SYNC_PLAYER
+	sync_set_bake_resolution(d, bake_step);
+#endif
+	for (i = 0; i < NUM_TRACKS; ++i)
+		tracks[i] = sync_get_track(d, track_names[i]);
+
+	/* forwards, then seeking back, within and across segments */
+	for (i = -40; i < 1000; ++i)
+		check_frame(d, tracks, i * 0.55);
+	for (i = 1000; i >= -40; i -= 3)
+		check_frame(d, tracks, i * 0.7);
+
+#ifndef SYNC_PLAYER
+	{
+		struct track_key key;
+		key.row = 100;
+		key.value = 42.0f;
+		key.type = KEY_STEP;
+
+		/* edits after sync_begin_frame() show up right away */
+		check_frame(d, tracks, 100.5);
+		for (i = 0; i < NUM_TRACKS; ++i) {
+			CHECK(!sync_set_key((struct sync_track *)tracks[i], &key));
+			CHECK(sync_get_val(tracks[i], 100.5) == 42.0);
+		}
+		check_frame(d, tracks, 100.5);
+		check_frame(d, tracks, 101.5);
+	}
+#endif
+
+	sync_destroy_device(d);
+}
+
+/* snapshots stay as published while their tracks change */
+static void test_publish(void)
+{
+	struct sync_device *d = sync_create_device("tst_sync");
+	struct sync_reader *r = sync_create_reader(d);
+	const struct sync_track *tracks[NUM_TRACKS], *s;
+	int i, j;
+
+	for (i = 0; i < NUM_TRACKS; ++i) {
+		tracks[i] = sync_get_track(d, track_names[i]);
+		CHECK(!sync_read_track(tracks[i]));
+	}
+
+	CHECK(!sync_publish(d));
+	sync_read_begin(r);
+	for (i = 0; i < NUM_TRACKS; ++i) {
+		s = sync_read_track(tracks[i]);
+		CHECK(s && s != tracks[i] && s->kind != TRACK_UNCLASSIFIED);
+		for (j = -40; j < 1000; ++j)
+			CHECK(same(sync_get_val(s, j * 0.55),
+			    sync_get_val(tracks[i], j * 0.55)));
+	}
+	sync_read_end(r);
+
+	/* unedited tracks keep their snapshot */
+	s = sync_read_track(tracks[0]);
+	CHECK(!sync_publish(d));
+	CHECK(sync_read_track(tracks[0]) == s && !d->retired);
+
+#ifndef SYNC_PLAYER
+	{
+		struct track_key key;
+		double old;
+
+		key.row = 100;
+		key.value = 42.0f;
+		key.type = KEY_STEP;
+
+		sync_read_begin(r);
+		s = sync_read_track(tracks[0]);
+		old = sync_get_val(s, 100.5);
+		CHECK(old != 42.0);
+		CHECK(!sync_set_key((struct sync_track *)tracks[0], &key));
+		CHECK(sync_get_val(s, 100.5) == old);
+
+		CHECK(!sync_publish(d));
+		CHECK(sync_get_val(sync_read_track(tracks[0]), 100.5) == 42.0);
+
+		/* kept while the reader may still be looking at it */
+		CHECK(d->retired && d->retired->track == s);
+		CHECK(sync_get_val(s, 100.5) == old);
+		sync_read_end(r);
+		CHECK(!sync_publish(d));
+		CHECK(!d->retired);
+	}
+#endif
+
+	sync_destroy_reader(r);
+	sync_destroy_device(d);
+}
+
+#ifndef SYNC_PLAYER
+
+/* wall-clock milliseconds for deadlines, as clock() stands still in waits */
+static unsigned long now_ms(void)
+{
+#ifdef _WIN32
+	return GetTickCount();
+#else
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (unsigned long)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+#endif
+}
+
+/* whether deadline is yet to come, allowing for wrap-around */
+static int before(unsigned long deadline)
+{
+	return (long)(now_ms() - deadline) < 0;
+}
+
+static int same_keys(const struct sync_track *a, const struct sync_track *b)
+{
+	int i;
+	if (a->num_keys != b->num_keys)
+		return 0;
+	for (i = 0; i < a->num_keys; ++i)
+		if (a->keys[i].row != b->keys[i].row ||
+		    a->keys[i].value != b->keys[i].value ||
+		    a->keys[i].type != b->keys[i].type)
+			return 0;
+	for (i = -10; i < 1100; ++i)
+		if (sync_get_val(a, i * 0.5) != sync_get_val(b, i * 0.5))
+			return 0;
+	return 1;
+}
+
+/* sync_set_keys() must match sync_set_key() for each key of the run */
+static void test_set_keys(void)
+{
+	struct sync_device *d = sync_create_device("tst_sync");
+	struct sync_track *a = (struct sync_track *)sync_get_track(d, "a");
+	struct sync_track *b = (struct sync_track *)sync_get_track(d, "b");
+	struct track_key run[64];
+	int i, j;
+
+	srand(1);
+	for (i = 0; i < 200; ++i) {
+		int num_keys = rand() % 64, row = rand() % 500;
+		for (j = 0; j < num_keys; ++j) {
+			run[j].row = row += 1 + rand() % 8;
+			run[j].value = (float)(rand() % 100);
+			run[j].type = (enum key_type)(rand() % KEY_TYPE_COUNT);
+			CHECK(!sync_set_key(a, run + j));
+		}
+		CHECK(!sync_set_keys(b, run, num_keys));
+		CHECK(same_keys(a, b));
+
+		/* and deletes shrink the storage without losing keys */
+		for (j = 0; j < a->num_keys / 2; ++j) {
+			int row = a->keys[rand() % a->num_keys].row;
+			CHECK(!sync_del_key(a, row));
+			CHECK(!sync_del_key(b, row));
+		}
+		CHECK(same_keys(a, b));
+		CHECK(a->num_keys <= a->capacity);
+	}
+
+	sync_destroy_device(d);
+}
+
+/* the last key at or before row, or -1, without the cursor or index */
+static int ref_floor(const struct sync_track *t, int row)
+{
+	int lo = 0, hi = t->num_keys;
+	while (lo < hi) {
+		int mid = lo + (hi - lo) / 2;
+		if (t->keys[mid].row <= row)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	return lo - 1;
+}
+
+/*
+ * Edits move keys under the cursor, so seeks forward and back in between
+ * must still agree with a plain search, with and without the index.
+ */
+static void test_cursor(void)
+{
+	struct sync_device *d = sync_create_device("tst_sync");
+	struct sync_track *t = (struct sync_track *)sync_get_track(d,
+	    "cursor");
+	int num_keys = INDEX_MIN_KEYS + INDEX_MIN_KEYS / 4;
+	struct track_key *keys = malloc(sizeof(*keys) * num_keys);
+	int i, j, row = 0;
+
+	for (i = 0; i < num_keys; ++i) {
+		keys[i].row = i * 8;
+		keys[i].value = (float)i;
+		keys[i].type = KEY_STEP;
+	}
+	CHECK(!sync_set_keys(t, keys, num_keys));
+	free(keys);
+
+	srand(2);
+	for (i = 0; i < 2000; ++i) {
+		struct track_key k;
+		int step = 1 + rand() % 3;
+
+		/* edit around the cursor, or anywhere */
+		k.row = rand() % 2 ? row + rand() % 41 - 20 :
+		    rand() % (num_keys * 8);
+		k.value = (float)i;
+		k.type = KEY_LINEAR;
+		if (rand() % 3 || !is_key_frame(t, k.row))
+			CHECK(!sync_set_key(t, &k));
+		else
+			CHECK(!sync_del_key(t, k.row));
+
+		/* as sync_update() does after edits */
+		if (i % 100 == 0 && t->num_keys >= INDEX_MIN_KEYS)
+			CHECK(!sync_build_index(t));
+
+		if (rand() % 2)
+			step = -step;
+		if (rand() % 8 == 0)
+			row = rand() % (num_keys * 8 + 20) - 10;
+		for (j = 0; j < 20; ++j, row += step)
+			CHECK(key_idx_floor(t, row) == ref_floor(t, row));
+	}
+
+	sync_destroy_device(d);
+}
+
+/* sync_get_val() as it was before segments, straight from the keys */
+static double ref_val(const struct sync_track *t, double row)
+{
+	const struct track_key *k;
+	double x;
+	int idx;
+
+	if (!t->num_keys)
+		return 0.0;
+	idx = ref_floor(t, (int)floor(row));
+	if (idx < 0)
+		return t->keys[0].value;
+	if (idx > t->num_keys - 2)
+		return t->keys[t->num_keys - 1].value;
+
+	k = t->keys + idx;
+	x = (row - k[0].row) / (k[1].row - k[0].row);
+	switch (k[0].type) {
+	case KEY_STEP:
+		return k[0].value;
+	case KEY_LINEAR:
+		break;
+	case KEY_SMOOTH:
+		x = x * x * (3 - 2 * x);
+		break;
+	case KEY_RAMP:
+		x = pow(x, 2.0);
+		break;
+	default:
+		CHECK(!"bad key type");
+	}
+	return k[0].value + (k[1].value - k[0].value) * x;
+}
+
+/* every segment against the original formulas, as keys come and go */
+static void check_segs(const struct sync_track *t)
+{
+	int i, j;
+	for (i = -1; i < t->num_keys; ++i) {
+		int start = i < 0 ? t->keys[0].row - 3 : t->keys[i].row;
+		int end = i + 1 < t->num_keys ? t->keys[i + 1].row :
+		    start + 3;
+		for (j = 0; j <= 8; ++j) {
+			double row = start + (end - start) * j / 8.0;
+			double ref = ref_val(t, row);
+			/* evaluated where the segment's own search puts it */
+			double val = sync_seg_eval(t->segs +
+			    ref_floor(t, (int)floor(row)) + 1, row);
+			CHECK(fabs(val - ref) <= 1e-12 * (1.0 + fabs(ref)));
+			/* and through the evaluator for its kind */
+			val = sync_get_val_inline(t, row);
+			CHECK(fabs(val - ref) <= 1e-12 * (1.0 + fabs(ref)));
+		}
+	}
+}
+
+/*
+ * The evaluator picked by the kind must agree with the formulas too,
+ * both on the general path edits leave a track on and once classified.
+ * Few types and values make for constant, step and linear tracks.
+ */
+static void test_segs(int num_types, int num_values)
+{
+	struct sync_device *d = sync_create_device("tst_sync");
+	struct sync_track *t = (struct sync_track *)sync_get_track(d,
+	    "segs");
+	struct track_key k;
+	int i;
+
+	srand(3);
+	for (i = 0; i < 400; ++i) {
+		k.row = rand() % 300;
+		k.value = (float)(rand() % num_values) / 16.0f - 60.0f;
+		k.type = (enum key_type)(rand() % num_types);
+		if (rand() % 4 || !is_key_frame(t, k.row))
+			CHECK(!sync_set_key(t, &k));
+		else
+			CHECK(!sync_del_key(t, k.row));
+		CHECK(t->kind == TRACK_UNCLASSIFIED);
+		if (t->num_keys)
+			check_segs(t);
+
+		/* as sync_update() does once the edits are applied */
+		sync_classify_track(t);
+		CHECK(t->kind != TRACK_UNCLASSIFIED);
+		if (t->num_keys)
+			check_segs(t);
+	}
+
+	sync_destroy_device(d);
+}
+
+/* an editor at the other end of an in-memory connection */
+struct fake_editor {
+	unsigned char data[8192];
+	int size, pos;
+	int hang_up; /* fail reads once the data runs out */
+	int chunk; /* most bytes per read, 0 for no limit */
+	int reads;
+	unsigned char sent[8192];
+	int sent_size, sends;
+	int send_chunk; /* most bytes per send, 0 for no limit */
+	int blocked; /* not writeable */
+};
+
+static void put_byte(struct fake_editor *e, unsigned char b)
+{
+	e->data[e->size++] = b;
+}
+
+static void put_u32(struct fake_editor *e, uint32_t v)
+{
+	v = htonl(v);
+	memcpy(e->data + e->size, &v, 4);
+	e->size += 4;
+}
+
+static int fake_poll(void *ctxt, int *readable, int *writeable)
+{
+	struct fake_editor *e = ctxt;
+	if (readable)
+		*readable = e->pos < e->size || e->hang_up;
+	if (writeable)
+		*writeable = !e->blocked;
+	return (readable && *readable) || (writeable && *writeable);
+}
+
+static int fake_send(void *ctxt, const void *buf, int len)
+{
+	struct fake_editor *e = ctxt;
+	if (e->send_chunk && len > e->send_chunk)
+		len = e->send_chunk;
+	memcpy(e->sent + e->sent_size, buf, len);
+	e->sent_size += len;
+	e->sends++;
+	return len;
+}
+
+static int fake_recv(void *ctxt, void *buf, int len)
+{
+	struct fake_editor *e = ctxt;
+	if (len > e->size - e->pos)
+		len = e->size - e->pos;
+	if (e->chunk && len > e->chunk)
+		len = e->chunk;
+	memcpy(buf, e->data + e->pos, len);
+	e->reads++;
+	e->pos += len;
+	return len;
+}
+
+static void fake_close(void *ctxt)
+{
+	(void)ctxt;
+}
+
+static void note_row(void *ctxt, int row)
+{
+	((int *)ctxt)[0] = row;
+}
+
+static void note_pause(void *ctxt, int flag)
+{
+	((int *)ctxt)[1] = flag;
+}
+
+/*
+ * Commands must have the same effect whether sync_update() reads them
+ * or the net thread does, also when split across reads or when the
+ * thread is stopped midway, and with the thread, no more than max_cmds
+ * may be applied per sync_update(). What arrived at once is read at once.
+ */
+static void test_net(int max_cmds, int hang_up, int chunk, int stop_after)
+{
+	static struct fake_editor e;
+	struct sync_device *d = sync_create_device("tst_sync");
+	const struct sync_track *a = sync_get_track(d, "net_a");
+	const struct sync_track *b = sync_get_track(d, "net_b");
+	struct sync_sockio_cb io = { fake_poll, fake_send, fake_recv,
+	    fake_close };
+	struct sync_cb cb = { note_pause, note_row, NULL };
+	int i, ret = 0, updates = 0, seen[2] = { -1, -1 };
+	unsigned long deadline = now_ms() + 10000;
+
+	memset(&e, 0, sizeof(e));
+	e.hang_up = hang_up;
+	e.chunk = chunk;
+	memcpy(e.data, "hello, demo!", 12);
+	e.size = 12;
+	for (i = 0; i < 300; ++i) {
+		union {
+			float f;
+			uint32_t i;
+		} v;
+		v.f = i * 0.5f;
+		put_byte(&e, 0); /* SET_KEY */
+		put_u32(&e, i % 3 ? 0 : 1);
+		put_u32(&e, i * 2);
+		put_u32(&e, v.i);
+		put_byte(&e, (unsigned char)(i % KEY_TYPE_COUNT));
+	}
+	put_byte(&e, 1); /* DELETE_KEY */
+	put_u32(&e, 0);
+	put_u32(&e, 2);
+	put_byte(&e, 3); /* SET_ROW */
+	put_u32(&e, 77);
+	put_byte(&e, 4); /* PAUSE */
+	put_byte(&e, 1);
+
+	if (max_cmds >= 0)
+		CHECK(!sync_set_net_thread(d, max_cmds));
+	CHECK(!sync_set_sockio_cb(d, &io, &e));
+	CHECK(!d->net == (max_cmds < 0));
+
+	while (seen[1] < 0 && before(deadline)) {
+		int before = a->num_keys + b->num_keys;
+		if (updates++ == stop_after)
+			CHECK(!sync_set_net_thread(d, -1));
+		ret = sync_update(d, 0, &cb, seen);
+		if (max_cmds > 0 && (stop_after < 0 || updates <= stop_after))
+			CHECK(a->num_keys + b->num_keys - before <= max_cmds);
+		if (ret)
+			break;
+	}
+	/* a hang-up may come with the commands, or in a later update */
+	while (hang_up && !ret && before(deadline))
+		ret = sync_update(d, 0, &cb, seen);
+
+	CHECK(seen[0] == 77 && seen[1] == 1);
+	CHECK(ret == -hang_up && (d->sockio_ctxt == NULL) == hang_up);
+	CHECK(a->num_keys == 199 && b->num_keys == 100);
+	CHECK(a->kind != TRACK_UNCLASSIFIED && b->kind != TRACK_UNCLASSIFIED);
+	/* the greeting, then the commands in one go, then the hang-up */
+	if (!chunk)
+		CHECK(e.reads == 2 + hang_up);
+	for (i = 0; i < 300; ++i) {
+		const struct sync_track *t = i % 3 ? a : b;
+		int idx = sync_find_key(t, i * 2);
+		if (i == 1)
+			CHECK(idx < 0);
+		else
+			CHECK(idx >= 0 && t->keys[idx].value == i * 0.5f &&
+			    t->keys[idx].type == i % KEY_TYPE_COUNT);
+	}
+
+	sync_destroy_device(d);
+}
+
+static int playing(void *ctxt)
+{
+	(void)ctxt;
+	return 1;
+}
+
+static void put_get_track(struct fake_editor *e, const char *name)
+{
+	put_byte(e, 2); /* GET_TRACK */
+	put_u32(e, (uint32_t)strlen(name));
+	memcpy(e->data + e->size, name, strlen(name));
+	e->size += (int)strlen(name);
+}
+
+/*
+ * Requests go out in one send when the socket takes them, and while it
+ * does not, they are kept in order for a later sync_update().
+ */
+static void test_send(void)
+{
+	static struct fake_editor e, expect;
+	struct sync_device *d = sync_create_device("tst_sync");
+	struct sync_sockio_cb io = { fake_poll, fake_send, fake_recv,
+	    fake_close };
+	struct sync_cb cb = { NULL, NULL, playing };
+	char name[16];
+	int i;
+
+	memset(&e, 0, sizeof(e));
+	memset(&expect, 0, sizeof(expect));
+	memcpy(e.data, "hello, demo!", 12);
+	e.size = 12;
+	memcpy(expect.data, "hello, synctracker!", 19);
+	expect.size = 19;
+
+	for (i = 0; i < 100; ++i) {
+		snprintf(name, sizeof(name), "send_%d", i);
+		sync_get_track(d, name);
+		put_get_track(&expect, name);
+	}
+	CHECK(!sync_set_sockio_cb(d, &io, &e));
+	CHECK(e.sends == 2);
+
+	e.blocked = 1;
+	e.send_chunk = 7;
+	for (i = 0; i < 10; ++i)
+		CHECK(!sync_update(d, i, &cb, NULL));
+	sync_get_track(d, "send_late");
+	CHECK(e.sends == 2);
+
+	/* the queued row is updated in place rather than queued again */
+	e.blocked = 0;
+	CHECK(!sync_update(d, 10, &cb, NULL));
+	put_byte(&expect, 3); /* SET_ROW */
+	put_u32(&expect, 10);
+	put_get_track(&expect, "send_late");
+	CHECK(e.sent_size == expect.size &&
+	    !memcmp(e.sent, expect.data, expect.size));
+
+	/* and sent right away while the socket keeps up */
+	CHECK(!sync_update(d, 11, &cb, NULL));
+	CHECK(!sync_update(d, 11, &cb, NULL));
+	put_byte(&expect, 3);
+	put_u32(&expect, 11);
+	CHECK(e.sent_size == expect.size &&
+	    !memcmp(e.sent, expect.data, expect.size));
+
+	sync_destroy_device(d);
+}
+
+static int wait_readable(SOCKET s, struct sync_device *d,
+    unsigned long deadline)
+{
+	struct timeval to = { 0, 1000 };
+	fd_set rfds;
+
+	while (before(deadline)) {
+		FD_ZERO(&rfds);
+		FD_SET(s, &rfds);
+		if (select((int)s + 1, &rfds, NULL, NULL, &to) > 0)
+			return 1;
+		sync_update(d, 0, NULL, NULL);
+	}
+	return 0;
+}
+
+/* play the editor on a loopback socket, taking its time to greet */
+static SOCKET accept_client(SOCKET l, struct sync_device *d,
+    unsigned long deadline)
+{
+	char buf[32];
+	int ret = -1;
+	SOCKET s;
+
+	CHECK(sync_update(d, 0, NULL, NULL) == -1);
+	s = accept(l, NULL, NULL);
+	CHECK(s != INVALID_SOCKET && wait_readable(s, d, deadline));
+	CHECK(recv(s, buf, 19, 0) == 19 &&
+	    !memcmp(buf, "hello, synctracker!", 19));
+
+	CHECK(send(s, "hello, ", 7, 0) == 7);
+	CHECK(sync_update(d, 0, NULL, NULL) == -1);
+	CHECK(send(s, "demo!", 5, 0) == 5);
+	while (ret && before(deadline))
+		ret = sync_update(d, 0, NULL, NULL);
+	CHECK(!ret);
+
+	/* the tracks are requested once greeted */
+	CHECK(wait_readable(s, d, deadline) &&
+	    recv(s, buf, 14, 0) == 14 && buf[0] == 2 &&
+	    !memcmp(buf + 5, "reconnect", 9));
+	return s;
+}
+
+/*
+ * sync_update() connects step by step, and again after a hang-up,
+ * without waiting on the editor.
+ */
+static void test_reconnect(void)
+{
+	struct sync_device *d = sync_create_device("tst_sync");
+	struct sockaddr_in sin;
+	socklen_t len = sizeof(sin);
+	SOCKET l = socket(AF_INET, SOCK_STREAM, 0);
+	unsigned long deadline = now_ms() + 10000;
+	int i;
+
+	memset(&sin, 0, sizeof(sin));
+	sin.sin_family = AF_INET;
+	sin.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	CHECK(l != INVALID_SOCKET &&
+	    !bind(l, (struct sockaddr *)&sin, sizeof(sin)) &&
+	    !listen(l, 1) &&
+	    !getsockname(l, (struct sockaddr *)&sin, &len));
+
+	sync_get_track(d, "reconnect");
+	CHECK(sync_update(d, 0, NULL, NULL) == -1);
+	CHECK(!sync_tcp_connect_async(d, "127.0.0.1", ntohs(sin.sin_port)));
+
+	for (i = 0; i < 2; ++i) {
+		closesocket(accept_client(l, d, deadline));
+		while (!sync_update(d, 0, NULL, NULL) && before(deadline))
+			;
+	}
+
+	/* with no editor, attempts fail without a connection */
+	closesocket(l);
+	for (i = 0; i < 100; ++i)
+		CHECK(sync_update(d, 0, NULL, NULL) == -1);
+	CHECK(!d->sockio_ctxt);
+
+	sync_destroy_device(d);
+}
+
+/*
+ * An idle net thread blocks on the socket, so what the editor sends
+ * later must still come through, and a stop must not wait on it.
+ */
+static void test_net_wait(void)
+{
+	struct sync_device *d = sync_create_device("tst_sync");
+	struct sync_cb cb = { note_pause, note_row, NULL };
+	struct sockaddr_in sin;
+	struct timeval to = { 0, 50000 };
+	socklen_t len = sizeof(sin);
+	SOCKET l = socket(AF_INET, SOCK_STREAM, 0), s;
+	unsigned long deadline = now_ms() + 10000;
+	fd_set rfds;
+	int seen[2] = { -1, -1 };
+
+	memset(&sin, 0, sizeof(sin));
+	sin.sin_family = AF_INET;
+	sin.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	CHECK(l != INVALID_SOCKET &&
+	    !bind(l, (struct sockaddr *)&sin, sizeof(sin)) &&
+	    !listen(l, 1) &&
+	    !getsockname(l, (struct sockaddr *)&sin, &len));
+
+	sync_get_track(d, "reconnect");
+	CHECK(!sync_tcp_connect_async(d, "127.0.0.1", ntohs(sin.sin_port)));
+	s = accept_client(l, d, deadline);
+	CHECK(!sync_set_net_thread(d, 0) && d->net);
+
+	/* give the thread time to run dry */
+	FD_ZERO(&rfds);
+	FD_SET(l, &rfds);
+	select((int)l + 1, &rfds, NULL, NULL, &to);
+
+	CHECK(send(s, "\x03\0\0\0\x2a", 5, 0) == 5); /* SET_ROW 42 */
+	while (seen[0] != 42 && before(deadline))
+		CHECK(!sync_update(d, 0, &cb, seen));
+	CHECK(seen[0] == 42);
+	CHECK(!sync_set_net_thread(d, -1));
+
+	closesocket(s);
+	closesocket(l);
+	sync_destroy_device(d);
+}
+
+#else
+
+static void test_bake(int step)
+{
+	struct sync_device *exact = sync_create_device("tst_sync");
+	struct sync_device *baked = sync_create_device("tst_sync");
+	size_t size = 0;
+	int i;
+
+	sync_set_bake_resolution(baked, step);
+
+	for (i = 0; i < NUM_TRACKS; ++i) {
+		const struct sync_track *e = sync_get_track(exact, track_names[i]);
+		const struct sync_track *b = sync_get_track(baked, track_names[i]);
+		int first = e->keys[0].row, last = e->keys[e->num_keys - 1].row;
+		int row;
+
+		CHECK(b->baked);
+		size += sizeof(float) * b->num_baked;
+
+		/* exact at the samples, and clamped outside the keys */
+		for (row = first; row <= last; row += step)
+			CHECK(sync_get_val(b, row) ==
+			    (float)sync_get_val(e, row));
+		CHECK(sync_get_val(b, first - 100.5) == e->keys[0].value);
+		CHECK(sync_get_val(b, last + 100.5) ==
+		    e->keys[e->num_keys - 1].value);
+
+		/*
+		 * Between two samples, the lerp can't stray further from the
+		 * exact value than the exact value itself varies over the
+		 * same interval.
+		 */
+		for (row = first; row < last; row += step) {
+			double lo = HUGE_VAL, hi = -HUGE_VAL;
+			int j;
+
+			for (j = 0; j <= 16 * step; ++j) {
+				double v = sync_get_val(e, row + j / 16.0);
+				lo = v < lo ? v : lo;
+				hi = v > hi ? v : hi;
+			}
+			for (j = 0; j <= 16 * step; ++j) {
+				double v = sync_get_val(b, row + j / 16.0);
+				double err = fabs(v - sync_get_val(e, row + j / 16.0));
+				CHECK(err <= hi - lo + 1e-5);
+			}
+		}
+	}
+
+	CHECK(sync_get_baked_size(baked) == size);
+	CHECK(sync_get_baked_size(exact) == 0);
+
+	sync_destroy_device(exact);
+	sync_destroy_device(baked);
+}
+
+/*
+ * Keys far apart must neither overflow the sample count nor ask for a
+ * huge table: such a track loads unbaked. Samples past the last key
+ * must not overflow the row either.
+ */
+static void test_bake_wide(void)
+{
+	static const int rows[][3] = { /* first, last, step */
+		{ -2000000000, 2000000000, 1 },
+		{ 0, MAX_BAKED, 1 },
+		{ 0, MAX_BAKED - 1, 1 },
+		{ 2147483000, 2147483600, 1000 }
+	};
+	struct track_key keys[2];
+	int i;
+
+	for (i = 0; i < (int)(sizeof(rows) / sizeof(rows[0])); ++i) {
+		struct sync_device *d = sync_create_device("tst_sync");
+		const struct sync_track *t;
+
+		keys[0].row = rows[i][0];
+		keys[0].value = 1.0f;
+		keys[0].type = KEY_LINEAR;
+		keys[1].row = rows[i][1];
+		keys[1].value = 3.0f;
+		keys[1].type = KEY_STEP;
+		write_track("tst_sync_wide.track", keys, 2);
+
+		sync_set_bake_resolution(d, rows[i][2]);
+		t = sync_get_track(d, "wide");
+		CHECK(t && t->num_keys == 2);
+		CHECK(!t->baked == (i < 2));
+		CHECK(sync_get_val(t, rows[i][0]) == 1.0);
+		CHECK(sync_get_val(t, rows[i][1] + 1000.0) == 3.0);
+		if (rows[i][2] == 1) {
+			CHECK(sync_get_val(t, rows[i][1]) == 3.0);
+			CHECK(fabs(sync_get_val(t, rows[i][0] / 2.0 +
+			    rows[i][1] / 2.0) - 2.0) < 1e-6);
+		}
+		sync_destroy_device(d);
+	}
+	remove("tst_sync_wide.track");
+}
+
+static void *bundle_open_cb(const char *path, const char *mode)
+{
+	return fopen(path, mode);
+}
+
+static size_t bundle_read_cb(void *ptr, size_t size, size_t nitems,
+    void *fp)
+{
+	return fread(ptr, size, nitems, (FILE *)fp);
+}
+
+static int bundle_close_cb(void *fp)
+{
+	return fclose((FILE *)fp);
+}
+
+static long file_size(const char *path)
+{
+	FILE *fp = fopen(path, "rb");
+	long size;
+	fseek(fp, 0, SEEK_END);
+	size = ftell(fp);
+	fclose(fp);
+	return size;
+}
+
+/*
+ * A bundle must load the same tracks as the separate .track files, up to
+ * the quantization step if one is set.
+ */
+static void test_bundle(int custom_io, float precision)
+{
+	struct sync_device *exact = sync_create_device("tst_sync");
+	struct sync_device *d;
+	long raw_size;
+	int i;
+
+	for (i = 0; i < NUM_TRACKS; ++i)
+		sync_get_track(exact, track_names[i]);
+	CHECK(!bundle_write("tst_sync_b.bundle", exact->tracks,
+	    exact->num_tracks));
+	raw_size = file_size("tst_sync_b.bundle");
+
+	if (precision >= 0.0f) {
+		for (i = 0; i < NUM_TRACKS; ++i)
+			exact->tracks[i]->precision = precision;
+		CHECK(!bundle_write("tst_sync_b.bundle", exact->tracks,
+		    exact->num_tracks));
+		CHECK(file_size("tst_sync_b.bundle") < raw_size);
+	}
+
+	d = sync_create_device("tst_sync_b");
+	if (custom_io) {
+		struct sync_io_cb cb;
+		cb.open = bundle_open_cb;
+		cb.read = bundle_read_cb;
+		cb.close = bundle_close_cb;
+		sync_set_io_cb(d, &cb);
+	}
+	CHECK(!sync_load_bundle(d));
+	CHECK(sync_load_bundle(d) < 0);
+
+	for (i = 0; i < NUM_TRACKS; ++i) {
+		const struct sync_track *e = sync_get_track(exact, track_names[i]);
+		const struct sync_track *b = sync_get_track(d, track_names[i]);
+		const char *keys = (const char *)b->keys;
+		int j;
+
+		/* classified when loaded, so readers never write the kind */
+		CHECK(b->kind != TRACK_UNCLASSIFIED &&
+		    e->kind != TRACK_UNCLASSIFIED);
+		CHECK(b->num_keys == e->num_keys);
+		if (b->num_keys != e->num_keys)
+			continue;
+
+		for (j = 0; j < e->num_keys; ++j) {
+			CHECK(b->keys[j].row == e->keys[j].row);
+			CHECK(b->keys[j].type == e->keys[j].type);
+			CHECK(fabs(b->keys[j].value - e->keys[j].value) <=
+			    (precision > 0.0f ? precision / 2 : 0.0));
+		}
+
+		if (precision > 0.0f)
+			continue;
+
+		for (j = -10; j < 1100; ++j)
+			CHECK(sync_get_val(b, j * 0.5) ==
+			    sync_get_val(e, j * 0.5));
+
+		/* raw keys are used straight from the bundle */
+		if (precision < 0.0f)
+			CHECK(keys >= (const char *)d->bundle &&
+			    keys < (const char *)d->bundle + d->bundle_size);
+	}
+
+	/* only the default callbacks may map the file */
+	CHECK(d->bundle_state == BUNDLE_ALLOCATED ||
+	    (!custom_io && d->bundle_state == BUNDLE_MAPPED));
+
+	/* tracks missing from the bundle are still empty, not an error */
+	CHECK(sync_get_track(d, "missing")->num_keys == 0);
+
+	sync_destroy_device(exact);
+	sync_destroy_device(d);
+	remove("tst_sync_b.bundle");
+}
+
+static int num_opens;
+
+static void *counting_open_cb(const char *path, const char *mode)
+{
+	num_opens++;
+	return fopen(path, mode);
+}
+
+/* a bundle in memory, with its first half of the tracks only */
+static void test_memory(int offset)
+{
+	struct sync_device *exact = sync_create_device("tst_sync");
+	struct sync_device *d = sync_create_device("tst_sync");
+	struct sync_io_cb cb;
+	char *buf;
+	long size;
+	FILE *fp;
+	int i;
+
+	for (i = 0; i < NUM_TRACKS; ++i)
+		sync_get_track(exact, track_names[i]);
+	CHECK(!bundle_write("tst_sync_m.bundle", exact->tracks,
+	    NUM_TRACKS / 2));
+
+	size = file_size("tst_sync_m.bundle");
+	buf = malloc(size + offset);
+	fp = fopen("tst_sync_m.bundle", "rb");
+	CHECK(fread(buf + offset, 1, size, fp) == (size_t)size);
+	fclose(fp);
+	remove("tst_sync_m.bundle");
+
+	num_opens = 0;
+	cb.open = counting_open_cb;
+	cb.read = bundle_read_cb;
+	cb.close = bundle_close_cb;
+	sync_set_io_cb(d, &cb);
+
+	CHECK(sync_load_tracks_from_memory(d, buf + offset, size - 1) < 0);
+	CHECK(!sync_load_tracks_from_memory(d, buf + offset, size));
+
+	for (i = 0; i < NUM_TRACKS; ++i) {
+		const struct sync_track *e = sync_get_track(exact, track_names[i]);
+		const struct sync_track *b = sync_get_track(d, track_names[i]);
+		const char *keys = (const char *)b->keys;
+
+		if (i >= NUM_TRACKS / 2) {
+			CHECK(b->num_keys == 0);
+			continue;
+		}
+
+		CHECK(b->num_keys == e->num_keys);
+		CHECK(!memcmp(b->keys, e->keys,
+		    sizeof(struct track_key) * e->num_keys));
+
+		/* in place when aligned, copied otherwise */
+		CHECK((keys >= buf && keys < buf + offset + size) ==
+		    !(offset % 4));
+	}
+	CHECK(num_opens == 0);
+
+	sync_destroy_device(exact);
+	sync_destroy_device(d);
+	free(buf);
+}
+
+/*
+ * The editor only saves .track files, so a bundle left on disk must not
+ * hide them unless asked for, and a key block that fails to decode falls
+ * back to its .track file.
+ */
+static void test_stale_bundle(void)
+{
+	struct sync_device *exact = sync_create_device("tst_sync");
+	struct sync_device *d = sync_create_device("tst_sync");
+	struct bundle_entry e;
+	uint32_t num_tracks;
+	char *buf;
+	long size;
+	FILE *fp;
+	int i;
+
+	for (i = 0; i < NUM_TRACKS; ++i)
+		sync_get_track(exact, track_names[i]);
+	for (i = 0; i < (int)exact->num_tracks; ++i)
+		exact->tracks[i]->precision = 1.0f / 64;
+	CHECK(!bundle_write("tst_sync.bundle", exact->tracks,
+	    exact->num_tracks));
+
+	for (i = 0; i < NUM_TRACKS; ++i) {
+		const struct sync_track *t = sync_get_track(d, track_names[i]);
+		const struct sync_track *x = sync_get_track(exact, track_names[i]);
+		CHECK(t->num_keys == x->num_keys &&
+		    !memcmp(t->keys, x->keys,
+		    sizeof(struct track_key) * x->num_keys));
+	}
+	CHECK(!d->bundle && d->bundle_state == BUNDLE_NONE);
+	sync_destroy_device(d);
+
+	/* garble the packed keys of the first track */
+	size = file_size("tst_sync.bundle");
+	buf = malloc(size);
+	fp = fopen("tst_sync.bundle", "rb");
+	CHECK(fread(buf, 1, size, fp) == (size_t)size);
+	fclose(fp);
+	remove("tst_sync.bundle");
+	CHECK(!bundle_open(buf, size, &num_tracks) &&
+	    !bundle_get_entry(buf, size, 0, &e) && e.size > 0);
+	memset(buf + (e.data - (const unsigned char *)buf), 0xff, e.size);
+
+	d = sync_create_device("tst_sync");
+	CHECK(!sync_load_tracks_from_memory(d, buf, size));
+	for (i = 0; i < NUM_TRACKS; ++i) {
+		const struct sync_track *t = sync_get_track(d, track_names[i]);
+		const struct sync_track *x = sync_get_track(exact, track_names[i]);
+		if (strcmp(track_names[i], e.name))
+			continue;
+		CHECK(t->num_keys == x->num_keys &&
+		    !memcmp(t->keys, x->keys,
+		    sizeof(struct track_key) * x->num_keys));
+	}
+
+	sync_destroy_device(exact);
+	sync_destroy_device(d);
+	free(buf);
+}
+
+/* a bad bundle in memory must leave the .track files to fall back on */
+static void test_bad_memory(void)
+{
+	struct sync_device *exact = sync_create_device("tst_sync");
+	struct sync_device *d = sync_create_device("tst_sync");
+	struct sync_io_cb cb;
+	char buf[64];
+	int i;
+
+	memset(buf, 0x5a, sizeof(buf));
+	num_opens = 0;
+	cb.open = counting_open_cb;
+	cb.read = bundle_read_cb;
+	cb.close = bundle_close_cb;
+	sync_set_io_cb(d, &cb);
+
+	CHECK(sync_load_tracks_from_memory(d, buf, sizeof(buf)) < 0);
+	CHECK(d->bundle_state != BUNDLE_MEMORY);
+
+	for (i = 0; i < NUM_TRACKS; ++i) {
+		const struct sync_track *e = sync_get_track(exact, track_names[i]);
+		const struct sync_track *t = sync_get_track(d, track_names[i]);
+		CHECK(t->num_keys == e->num_keys);
+		CHECK(!memcmp(t->keys, e->keys,
+		    sizeof(struct track_key) * e->num_keys));
+	}
+	CHECK(num_opens >= NUM_TRACKS);
+
+	sync_destroy_device(exact);
+	sync_destroy_device(d);
+}
+
+#endif /* defined(SYNC_PLAYER) */
+
+int main(void)
+{
+	write_tracks();
+	test_bad_size();
+	test_inline();
+	test_simd(0);
+	test_range(0);
+	test_group(0);
+	test_frame(0);
+	test_publish();
+
+#ifndef SYNC_PLAYER
+	test_set_keys();
+	test_cursor();
+	test_segs(KEY_TYPE_COUNT, 2000);
+	test_segs(1, 3);
+	test_segs(2, 3);
+	test_net(-1, 0, 0, -1);
+	test_net(-1, 1, 0, -1);
+	test_net(-1, 0, 5, -1);
+	test_net(0, 0, 0, -1);
+	test_net(0, 1, 0, -1);
+	test_net(0, 1, 3, -1);
+	test_net(7, 0, 0, -1);
+	test_net(7, 1, 0, -1);
+	test_net(7, 0, 5, 3);
+	test_net(1, 1, 0, 20);
+	test_send();
+	test_reconnect();
+	test_net_wait();
+#else
+	test_bake(1);
+	test_bake(4);
+	test_bake(13);
+	test_bake_wide();
+	test_simd(4);
+	test_range(4);
+	test_group(4);
+	test_frame(4);
+	test_bundle(0, -1.0f);
+	test_bundle(1, -1.0f);
+	test_bundle(0, 0.0f);
+	test_bundle(0, 1.0f / 64);
+	test_bundle(1, 0.1f);
+	test_memory(0);
+	test_memory(1);
+	test_bad_memory();
+	test_stale_bundle();
+#endif
+
+	remove_tracks();
+
+	if (failures) {
+		fprintf(stderr, "%d check(s) failed\n", failures);
+		return EXIT_FAILURE;
+	}
+	return EXIT_SUCCESS;
+}
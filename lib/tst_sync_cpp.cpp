@@ -0,0 +1,136 @@
+/* Tests for sync.hpp, run with `make check`. */
+
+#include "sync.hpp"
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+static int failures;
+
+#define CHECK(expr) \
+	do { \
+		if (!(expr)) { \
+			fprintf(stderr, "%s:%d: check failed: %s\n", \
+			    __FILE__, __LINE__, #expr); \
+			failures++; \
+		} \
+	} while (0)
+
+/* bit for bit, so -0.0 and 0.0 differ */
+template <typename T>
+static bool same(T a, T b)
+{
+	return !memcmp(&a, &b, sizeof(T));
+}
+
+static const char *track_names[] = { "step", "linear", "smooth", "mixed",
+    "single" };
+static const int num_tracks = sizeof(track_names) / sizeof(track_names[0]);
+
+/* write a track the way save_track() does */
+static void write_track(int i)
+{
+	char path[64];
+	int num_keys = i == num_tracks - 1 ? 1 : 32;
+
+	snprintf(path, sizeof(path), "tst_sync_cpp_%s.track", track_names[i]);
+	FILE *fp = fopen(path, "wb");
+	if (!fp) {
+		perror(path);
+		exit(EXIT_FAILURE);
+	}
+
+	fwrite(&num_keys, sizeof(int), 1, fp);
+	for (int j = 0; j < num_keys; ++j) {
+		int row = j * 5 + (j * j) % 3;
+		float value = (float)((j * 29) % 17) * 0.3f - 2.0f;
+		char type = (char)(i < 3 ? i : j % KEY_TYPE_COUNT);
+		fwrite(&row, sizeof(int), 1, fp);
+		fwrite(&value, sizeof(float), 1, fp);
+		fwrite(&type, sizeof(char), 1, fp);
+	}
+	fclose(fp);
+}
+
+template <rocket::Kind K>
+static void check_kind(rocket::Track t, double row)
+{
+	CHECK(same(t.get<double, K>(row), sync_get_val(t.get(), row)));
+	CHECK(same(t.get<float, K>(row), (float)sync_get_val(t.get(), row)));
+}
+
+/* every path must match sync_get_val(), whatever kind it is told */
+static void test_track(rocket::Device &d, int i)
+{
+	rocket::Track t = d.track(track_names[i]);
+
+	CHECK(t && t.name() == track_names[i]);
+	for (int j = -40; j < 400; ++j) {
+		double row = j * 0.45;
+		CHECK(same(t.get(row), sync_get_val(t.get(), row)));
+		CHECK(same(t(row), sync_get_val(t.get(), row)));
+		check_kind<rocket::Kind::Constant>(t, row);
+		check_kind<rocket::Kind::Step>(t, row);
+		check_kind<rocket::Kind::Linear>(t, row);
+		check_kind<rocket::Kind::Mixed>(t, row);
+	}
+}
+
+static void test_group(rocket::Device &d)
+{
+	rocket::TrackGroup<3> g(d, { "step", "smooth", "single" });
+
+	CHECK(g && g.size() == 3);
+	for (int j = -40; j < 400; ++j) {
+		double row = j * 0.45;
+		std::array<double, 3> v = g.get(row);
+		auto [x, y, z] = g.get<float>(row);
+		CHECK(same(v[0], g[0].get(row)) && same(v[1], g[1].get(row)) &&
+		    same(v[2], g[2].get(row)));
+		CHECK(same(x, (float)v[0]) && same(y, (float)v[1]) &&
+		    same(z, (float)v[2]));
+	}
+}
+
+static void test_device()
+{
+	rocket::Device a("tst_sync_cpp");
+	const sync_track *t = a.track("step").get();
+
+	/* a move hands over the device along with its tracks */
+	rocket::Device b(std::move(a));
+	CHECK(!a && b && b.track("step").get() == t);
+
+	/* names longer than the stack copy go through the heap */
+	std::string name(300, 'x');
+	CHECK(b.track(name).name() == name);
+}
+
+int main()
+{
+	rocket::Device d("tst_sync_cpp");
+
+	for (int i = 0; i < num_tracks; ++i)
+		write_track(i);
+
+	CHECK(d);
+	for (int i = 0; i < num_tracks; ++i)
+		test_track(d, i);
+	CHECK(d.track("step").kind() == rocket::Kind::Step);
+	CHECK(d.track("single").kind() == rocket::Kind::Constant);
+	test_group(d);
+	test_device();
+
+	for (int i = 0; i < num_tracks; ++i) {
+		char path[64];
+		snprintf(path, sizeof(path), "tst_sync_cpp_%s.track",
+		    track_names[i]);
+		remove(path);
+	}
+
+	if (failures) {
+		fprintf(stderr, "%d check(s) failed\n", failures);
+		return EXIT_FAILURE;
+	}
+	return EXIT_SUCCESS;
+}